@@ -0,0 +1,103 @@
+/**
+ * TheoraPlay; multithreaded Ogg Theora/Ogg Vorbis decoding.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+// Measures how long the decoding thread takes to notice that the app pulled
+//  a frame out of a full queue and get back to decoding. We hold the queue
+//  full, take one frame, and time how long until it's full again.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "theoraplay.h"
+
+#define MAXFRAMES 8
+#define SAMPLES 100
+
+static long long now_usecs(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (((long long) tv.tv_sec) * 1000000) + ((long long) tv.tv_usec);
+} // now_usecs
+
+static int wait_for_full(THEORAPLAY_Decoder *decoder)
+{
+    while (THEORAPLAY_isDecoding(decoder))
+    {
+        if (THEORAPLAY_availableVideo(decoder) >= MAXFRAMES)
+            return 1;
+        // spin; we want microsecond resolution here.
+    } // while
+    return 0;
+} // wait_for_full
+
+static void dofile(const char *fname)
+{
+    THEORAPLAY_Decoder *decoder = NULL;
+    const THEORAPLAY_VideoFrame *video = NULL;
+    const THEORAPLAY_AudioPacket *audio = NULL;
+    long long total = 0;
+    long long lo = -1;
+    long long hi = 0;
+    int samples = 0;
+
+    printf("Trying file '%s' ...\n", fname);
+    decoder = THEORAPLAY_startDecodeFile(fname, MAXFRAMES, THEORAPLAY_VIDFMT_YV12, NULL, 1);
+    if (!decoder)
+    {
+        printf("Failed to start decoding!\n");
+        return;
+    } // if
+
+    while (samples < SAMPLES)
+    {
+        long long start, elapsed;
+
+        if (!wait_for_full(decoder))
+            break;
+
+        // don't let audio pile up forever while we hold the video queue full.
+        while ((audio = THEORAPLAY_getAudio(decoder)) != NULL)
+            THEORAPLAY_freeAudio(audio);
+
+        start = now_usecs();
+        video = THEORAPLAY_getVideo(decoder);
+        THEORAPLAY_freeVideo(video);
+        if (!wait_for_full(decoder))
+            break;
+        elapsed = now_usecs() - start;
+
+        total += elapsed;
+        if ((lo < 0) || (elapsed < lo)) lo = elapsed;
+        if (elapsed > hi) hi = elapsed;
+        samples++;
+    } // while
+
+    if (THEORAPLAY_decodingError(decoder))
+        printf("There was an error decoding this file!\n");
+
+    if (samples == 0)
+        printf("File ended before we could measure anything.\n");
+    else
+    {
+        printf("refill time over %d frames: min %lld us, avg %lld us, max %lld us\n",
+               samples, lo, total / samples, hi);
+    } // else
+
+    THEORAPLAY_stopDecode(decoder);
+} // dofile
+
+int main(int argc, char **argv)
+{
+    int i;
+    for (i = 1; i < argc; i++)
+        dofile(argv[i]);
+    printf("done all files!\n");
+    return 0;
+} // main
+
+// end of latencytest.c ...
@@ -16,6 +16,9 @@ fi
 
 CFLAGS="-O0 -ggdb3 -Wall -I.."
 gcc -o ./testtheoraplay $CFLAGS ../theoraplay.c ./testtheoraplay.c -logg -lvorbis -ltheoradec $LINKFLAGS
+gcc -o ./latencytest $CFLAGS ../theoraplay.c ./latencytest.c -logg -lvorbis -ltheoradec $LINKFLAGS
+gcc -o ./seekbench $CFLAGS ../theoraplay.c ./seekbench.c -logg -lvorbis -ltheoradec $LINKFLAGS
+gcc -o ./thumbnails $CFLAGS ../theoraplay.c ./thumbnails.c -logg -lvorbis -ltheoradec $LINKFLAGS
 gcc -o ./simplesdl $CFLAGS ../theoraplay.c ./simplesdl.c `sdl-config --cflags --libs`  -logg -lvorbis -ltheoradec $LINKFLAGS
 gcc -o ./sdltheoraplay $CFLAGS ../theoraplay.c ./sdltheoraplay.c `sdl-config --cflags --libs`  -logg -lvorbis -ltheoradec $LINKFLAGS $LINKGLFLAGS
 
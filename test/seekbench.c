@@ -0,0 +1,228 @@
+/**
+ * TheoraPlay; multithreaded Ogg Theora/Ogg Vorbis decoding.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+// Measures what each seek costs: how many times the decoder moved the file
+//  position (one per search probe, plus one to jump to the result), and how
+//  many bytes it read before handing us the first frame at the new spot.
+//  Seeks to the times (in milliseconds) listed after the filename, or every
+//  seven seconds until we run off the end of the file if there aren't any.
+//  Pass --keyframe first to measure THEORAPLAY_seekKeyframe() instead.
+//  Also reports how many frames were decoded and thrown away on the way to
+//  each target, and how fast that catch-up went.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "theoraplay.h"
+
+typedef struct CountingIo
+{
+    FILE *f;
+    unsigned long seeks;
+    unsigned long bytes;
+} CountingIo;
+
+static long countingio_read(THEORAPLAY_Io *io, void *buf, long buflen)
+{
+    CountingIo *counter = (CountingIo *) io->userdata;
+    const size_t br = fread(buf, 1, buflen, counter->f);
+    if ((br == 0) && ferror(counter->f))
+        return -1;
+    counter->bytes += (unsigned long) br;
+    return (long) br;
+} // countingio_read
+
+static long countingio_streamlen(THEORAPLAY_Io *io)
+{
+    CountingIo *counter = (CountingIo *) io->userdata;
+    const long origpos = ftell(counter->f);
+    long retval = -1;
+    if (fseek(counter->f, 0, SEEK_END) == 0)
+        retval = ftell(counter->f);
+    fseek(counter->f, origpos, SEEK_SET);
+    return retval;
+} // countingio_streamlen
+
+static int countingio_seek(THEORAPLAY_Io *io, long absolute_offset)
+{
+    CountingIo *counter = (CountingIo *) io->userdata;
+    counter->seeks++;
+    return fseek(counter->f, absolute_offset, SEEK_SET);
+} // countingio_seek
+
+static void countingio_close(THEORAPLAY_Io *io)
+{
+    CountingIo *counter = (CountingIo *) io->userdata;
+    fclose(counter->f);
+    free(counter);
+    free(io);
+} // countingio_close
+
+static long long now_usecs(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (((long long) tv.tv_sec) * 1000000) + ((long long) tv.tv_usec);
+} // now_usecs
+
+// Pump until something from this seek generation shows up. Returns zero if
+//  the file ended (or broke) first.
+static int wait_for_seek(THEORAPLAY_Decoder *decoder, const unsigned int generation, unsigned int *playms)
+{
+    const THEORAPLAY_VideoFrame *video;
+    const THEORAPLAY_AudioPacket *audio;
+    const int hasvideo = THEORAPLAY_hasVideoStream(decoder);
+
+    while (THEORAPLAY_isDecoding(decoder))
+    {
+        THEORAPLAY_pumpDecode(decoder, 1);
+
+        while ((audio = THEORAPLAY_getAudio(decoder)) != NULL)
+        {
+            const int done = !hasvideo && (audio->seek_generation == generation);
+            if (done)
+                *playms = audio->playms;
+            THEORAPLAY_freeAudio(audio);
+            if (done)
+                return 1;
+        } // while
+
+        while ((video = THEORAPLAY_getVideo(decoder)) != NULL)
+        {
+            const int done = (video->seek_generation == generation);
+            if (done)
+                *playms = video->playms;
+            THEORAPLAY_freeVideo(video);
+            if (done)
+                return 1;
+        } // while
+    } // while
+
+    return 0;
+} // wait_for_seek
+
+static void dofile(const char *fname, const unsigned long *targets, const int numtargets, const int keyframe)
+{
+    THEORAPLAY_Decoder *decoder = NULL;
+    THEORAPLAY_Io *io = NULL;
+    CountingIo *counter = NULL;
+    unsigned long totalseeks = 0;
+    unsigned long totalbytes = 0;
+    unsigned long totalcatchup = 0;
+    long long totalusecs = 0;
+    int seeks = 0;
+    int i;
+
+    printf("Trying file '%s' ...\n", fname);
+
+    io = (THEORAPLAY_Io *) malloc(sizeof (THEORAPLAY_Io));
+    counter = (CountingIo *) calloc(1, sizeof (CountingIo));
+    if (!io || !counter || ((counter->f = fopen(fname, "rb")) == NULL))
+    {
+        printf("Couldn't open file!\n");
+        free(counter);
+        free(io);
+        return;
+    } // if
+
+    io->read = countingio_read;
+    io->streamlen = countingio_streamlen;
+    io->seek = countingio_seek;
+    io->close = countingio_close;
+    io->userdata = counter;
+
+    // not multithreaded, so the counters only change when we pump.
+    decoder = THEORAPLAY_startDecode(io, 30, THEORAPLAY_VIDFMT_YV12, NULL, 0);
+    if (!decoder)
+    {
+        printf("Failed to start decoding!\n");
+        return;
+    } // if
+
+    while (!THEORAPLAY_isInitialized(decoder) && THEORAPLAY_isDecoding(decoder))
+        THEORAPLAY_pumpDecode(decoder, 1);
+
+    for (i = 0; (numtargets == 0) || (i < numtargets); i++)
+    {
+        const unsigned long targetms = numtargets ? targets[i] : ((unsigned long) (i + 1)) * 7000;
+        unsigned int generation, catchup, playms = 0;
+        long long start, elapsed;
+
+        if (!THEORAPLAY_isDecoding(decoder))
+            break;
+
+        counter->seeks = counter->bytes = 0;
+        start = now_usecs();
+        generation = keyframe ? THEORAPLAY_seekKeyframe(decoder, targetms) : THEORAPLAY_seek(decoder, targetms);
+        if (!wait_for_seek(decoder, generation, &playms))
+        {
+            printf("seek to %lu ms: ran off the end of the file.\n", targetms);
+            break;
+        } // if
+        elapsed = now_usecs() - start;
+        catchup = THEORAPLAY_getSeekCatchupFrames(decoder);
+
+        printf("seek to %lu ms: landed at %u ms, %lu io seeks, %lu bytes read, %u catch-up frames, %lld us\n",
+               targetms, playms, counter->seeks, counter->bytes, catchup, elapsed);
+
+        totalseeks += counter->seeks;
+        totalbytes += counter->bytes;
+        totalcatchup += catchup;
+        totalusecs += elapsed;
+        seeks++;
+    } // for
+
+    if (THEORAPLAY_decodingError(decoder))
+        printf("There was an error decoding this file!\n");
+
+    if (seeks > 0)
+    {
+        printf("average over %d seeks: %.1f io seeks, %lu bytes read, %.1f catch-up frames, %lld us\n",
+               seeks, ((double) totalseeks) / seeks, totalbytes / seeks, ((double) totalcatchup) / seeks, totalusecs / seeks);
+        if (totalusecs > 0)
+            printf("catch-up rate: %.1f frames/sec\n", (((double) totalcatchup) * 1000000.0) / ((double) totalusecs));
+    } // if
+
+    THEORAPLAY_stopDecode(decoder);
+} // dofile
+
+int main(int argc, char **argv)
+{
+    const char *argv0 = argv[0];
+    unsigned long *targets = NULL;
+    int keyframe = 0;
+    int i;
+
+    if ((argc > 1) && (strcmp(argv[1], "--keyframe") == 0))
+    {
+        keyframe = 1;
+        argc--;
+        argv++;
+    } // if
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "USAGE: %s [--keyframe] <file.ogv> [ms ...]\n", argv0);
+        return 1;
+    } // if
+
+    if (argc > 2)
+    {
+        targets = (unsigned long *) malloc(sizeof (unsigned long) * (argc - 2));
+        if (!targets)
+            return 1;
+        for (i = 2; i < argc; i++)
+            targets[i - 2] = strtoul(argv[i], NULL, 10);
+    } // if
+
+    dofile(argv[1], targets, argc - 2, keyframe);
+    free(targets);
+    printf("done!\n");
+    return 0;
+} // main
+
+// end of seekbench.c ...
@@ -183,9 +183,10 @@ static void playfile(const char *fname)
     {
         Uint32 now;
 
-        THEORAPLAY_pumpDecode(decoder, 5);
-
         now = SDL_GetTicks() - baseticks;
+        THEORAPLAY_setPlaybackTime(decoder, now);  // don't bother converting frames we'd skip anyhow.
+
+        THEORAPLAY_pumpDecode(decoder, 5);
 
         if (!video)
             video = THEORAPLAY_getVideo(decoder);
@@ -323,6 +324,9 @@ static void playfile(const char *fname)
     else
         printf("done with this file!\n");
 
+    if (decoder)
+        printf("decoder dropped %u late frames.\n", THEORAPLAY_getDroppedFrames(decoder));
+
     if (overlay) SDL_FreeYUVOverlay(overlay);
     if (video) THEORAPLAY_freeVideo(video);
     if (audio) THEORAPLAY_freeAudio(audio);
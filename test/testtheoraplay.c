@@ -7,25 +7,80 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include "theoraplay.h"
 
-static void dofile(const char *fname, const THEORAPLAY_VideoFormat vidfmt)
+typedef enum Source
+{
+    SOURCE_FILE,
+    SOURCE_MMAP,
+    SOURCE_MEMORY
+} Source;
+
+static unsigned char *loadfile(const char *fname, size_t *len)
+{
+    unsigned char *buf = NULL;
+    FILE *f = fopen(fname, "rb");
+    long flen;
+
+    if (!f)
+        return NULL;
+    else if ((fseek(f, 0, SEEK_END) == 0) && ((flen = ftell(f)) > 0) && (fseek(f, 0, SEEK_SET) == 0))
+    {
+        buf = (unsigned char *) malloc((size_t) flen);
+        if (buf && (fread(buf, (size_t) flen, 1, f) != 1))
+        {
+            free(buf);
+            buf = NULL;
+        } // if
+        *len = (size_t) flen;
+    } // else if
+
+    fclose(f);
+    return buf;
+} // loadfile
+
+static void dofile(const char *fname, const THEORAPLAY_VideoFormat vidfmt, const THEORAPLAY_DecoderOptions *options, const int pplevel, const Source source, const unsigned int slowms)
 {
     THEORAPLAY_Decoder *decoder = NULL;
     const THEORAPLAY_VideoFrame *video = NULL;
     const THEORAPLAY_AudioPacket *audio = NULL;
+    unsigned long poolhits, poolmisses;
+    unsigned char *buf = NULL;
+    size_t buflen = 0;
 
     printf("Trying file '%s' ...\n", fname);
-    decoder = THEORAPLAY_startDecodeFile(fname, 20, vidfmt, NULL, 1);
+    if (source == SOURCE_MMAP)
+    {
+        THEORAPLAY_Io64 *io = THEORAPLAY_createMmapIo(fname, NULL);
+        decoder = io ? THEORAPLAY_startDecodeIo64(io, 20, vidfmt, NULL, 1, options) : NULL;
+    } // if
+    else if (source == SOURCE_MEMORY)
+    {
+        buf = loadfile(fname, &buflen);
+        decoder = buf ? THEORAPLAY_startDecodeMemory(buf, buflen, 20, vidfmt, NULL, 1, options) : NULL;
+    } // else if
+    else
+        decoder = THEORAPLAY_startDecodeFileEx(fname, 20, vidfmt, NULL, 1, options);
+    THEORAPLAY_setPostProcessingLevel(decoder, pplevel);
     while (THEORAPLAY_isDecoding(decoder))
     {
         video = THEORAPLAY_getVideo(decoder);
         if (video)
         {
-            printf("Got video frame (%u ms)!\n", video->playms);
+            printf("Got %ux%u video frame (%u ms, pp level %d of %d)!\n", video->width, video->height, video->playms,
+                   THEORAPLAY_getPostProcessingLevel(decoder), THEORAPLAY_getMaxPostProcessingLevel(decoder));
+            if (vidfmt == THEORAPLAY_VIDFMT_PLANES)
+            {
+                int i;
+                for (i = 0; i < 3; i++)
+                    printf("  plane %d: %ux%u, stride %d\n", i, video->planes[i].width, video->planes[i].height, video->planes[i].stride);
+            } // if
             THEORAPLAY_freeVideo(video);
+            if (slowms)
+                usleep(slowms * 1000);  // act like an app that's busy rendering, so the decoder gets ahead.
         } // if
 
         audio = THEORAPLAY_getAudio(decoder);
@@ -44,14 +99,24 @@ static void dofile(const char *fname, const THEORAPLAY_VideoFormat vidfmt)
     else
         printf("done with this file!\n");
 
+    THEORAPLAY_getFramePoolStats(decoder, &poolhits, &poolmisses);
+    printf("frame pool: %lu hits, %lu misses\n", poolhits, poolmisses);
+
     THEORAPLAY_stopDecode(decoder);
+    free(buf);  // only after the decoder is done with it.
 } // dofile
 
 int main(int argc, char **argv)
 {
     THEORAPLAY_VideoFormat vidfmt = THEORAPLAY_VIDFMT_YV12;
+    THEORAPLAY_DecoderOptions options;
+    int pplevel = 0;
+    Source source = SOURCE_FILE;
+    unsigned int slowms = 0;
     int i;
 
+    memset(&options, '\0', sizeof (options));
+
     for (i = 1; i < argc; i++)
     {
         if (strcmp(argv[i], "--rgb") == 0)
@@ -64,8 +129,30 @@ int main(int argc, char **argv)
             vidfmt = THEORAPLAY_VIDFMT_RGB565;
         else if (strcmp(argv[i], "--yv12") == 0)
             vidfmt = THEORAPLAY_VIDFMT_YV12;
+        else if (strcmp(argv[i], "--planes") == 0)
+            vidfmt = THEORAPLAY_VIDFMT_PLANES;
+        else if (strcmp(argv[i], "--mmap") == 0)
+            source = SOURCE_MMAP;
+        else if (strcmp(argv[i], "--memory") == 0)
+            source = SOURCE_MEMORY;
+        else if ((strcmp(argv[i], "--size") == 0) && (i < (argc - 1)))
+            sscanf(argv[++i], "%ux%u", &options.output_width, &options.output_height);
+        else if ((strcmp(argv[i], "--readsize") == 0) && (i < (argc - 1)))
+        {
+            i++;
+            options.read_size = (strcmp(argv[i], "adaptive") == 0) ? THEORAPLAY_READSIZE_ADAPTIVE : (unsigned int) strtoul(argv[i], NULL, 10);
+        } // else if
+        else if ((strcmp(argv[i], "--readahead") == 0) && (i < (argc - 1)))
+            options.readahead = (unsigned int) strtoul(argv[++i], NULL, 10);
+        else if ((strcmp(argv[i], "--pp") == 0) && (i < (argc - 1)))
+        {
+            i++;
+            pplevel = (strcmp(argv[i], "adaptive") == 0) ? THEORAPLAY_PPLEVEL_ADAPTIVE : atoi(argv[i]);
+        } // else if
+        else if ((strcmp(argv[i], "--slow") == 0) && (i < (argc - 1)))
+            slowms = (unsigned int) strtoul(argv[++i], NULL, 10);
         else
-            dofile(argv[i], vidfmt);
+            dofile(argv[i], vidfmt, &options, pplevel, source, slowms);
     } // for
 
     printf("done all files!\n");
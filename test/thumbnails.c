@@ -0,0 +1,101 @@
+/**
+ * TheoraPlay; multithreaded Ogg Theora/Ogg Vorbis decoding.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+// Pulls thumbnails out of a file with THEORAPLAY_getThumbnailsFile() and
+//  writes each one to thumbnail-N.ppm, so you can look at them. Takes the
+//  times (in milliseconds) after the filename, or makes ten, a second apart,
+//  if there aren't any. Pass --size WxH first to change the 160x90 default.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "theoraplay.h"
+
+static long long now_usecs(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (((long long) tv.tv_sec) * 1000000) + ((long long) tv.tv_usec);
+} // now_usecs
+
+static int write_ppm(const char *fname, const THEORAPLAY_VideoFrame *video)
+{
+    FILE *f = fopen(fname, "wb");
+    unsigned int y;
+    if (!f)
+        return 0;
+    fprintf(f, "P6\n%u %u\n255\n", video->width, video->height);
+    for (y = 0; y < video->height; y++)
+        fwrite(video->planes[0].data + (video->planes[0].stride * (int) y), 3, video->width, f);
+    return (fclose(f) == 0);
+} // write_ppm
+
+int main(int argc, char **argv)
+{
+    const char *argv0 = argv[0];
+    const THEORAPLAY_VideoFrame **thumbs = NULL;
+    unsigned long *targets = NULL;
+    unsigned int width = 160;
+    unsigned int height = 90;
+    unsigned int count, i;
+    long long start, elapsed;
+    int made;
+
+    if ((argc > 2) && (strcmp(argv[1], "--size") == 0))
+    {
+        if (sscanf(argv[2], "%ux%u", &width, &height) != 2)
+        {
+            fprintf(stderr, "%s: bad size '%s'\n", argv0, argv[2]);
+            return 1;
+        } // if
+        argc -= 2;
+        argv += 2;
+    } // if
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "USAGE: %s [--size WxH] <file.ogv> [ms ...]\n", argv0);
+        return 1;
+    } // if
+
+    count = (argc > 2) ? (unsigned int) (argc - 2) : 10;
+    targets = (unsigned long *) malloc(sizeof (unsigned long) * count);
+    thumbs = (const THEORAPLAY_VideoFrame **) malloc(sizeof (THEORAPLAY_VideoFrame *) * count);
+    if (!targets || !thumbs)
+        return 1;
+
+    for (i = 0; i < count; i++)
+        targets[i] = (argc > 2) ? strtoul(argv[i + 2], NULL, 10) : (unsigned long) (i * 1000);
+
+    start = now_usecs();
+    made = THEORAPLAY_getThumbnailsFile(argv[1], targets, count, width, height, THEORAPLAY_VIDFMT_RGB, NULL, thumbs);
+    elapsed = now_usecs() - start;
+
+    printf("made %d of %u thumbnails in %lld us\n", made, count, elapsed);
+
+    for (i = 0; i < count; i++)
+    {
+        char fname[64];
+        if (!thumbs[i])
+        {
+            printf("%lu ms: no thumbnail\n", targets[i]);
+            continue;
+        } // if
+
+        snprintf(fname, sizeof (fname), "thumbnail-%u.ppm", i);
+        printf("%lu ms: keyframe at %u ms, %ux%u, %s\n", targets[i], thumbs[i]->playms,
+               thumbs[i]->width, thumbs[i]->height, write_ppm(fname, thumbs[i]) ? fname : "couldn't write it!");
+        THEORAPLAY_freeVideo(thumbs[i]);
+    } // for
+
+    free(thumbs);
+    free(targets);
+    printf("done!\n");
+    return 0;
+} // main
+
+// end of thumbnails.c ...
@@ -10,37 +10,99 @@
 //  libtheora-1.1.1/examples/player_example.c, but this is all my own
 //  code.
 
+// so fseeko() and ftello() (and mmap()) take 64-bit offsets on 32-bit systems.
+#if !defined(_WIN32) && !defined(_FILE_OFFSET_BITS)
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <assert.h>
 
 #ifdef _WIN32
 #include <windows.h>
 #define THEORAPLAY_THREAD_T    HANDLE
 #define THEORAPLAY_MUTEX_T     HANDLE
-#define sleepms(x) Sleep(x)
+#define THEORAPLAY_SEM_T       HANDLE
 #elif defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
 #define THEORAPLAY_ONLY_SINGLE_THREADED 1
 #define THEORAPLAY_THREAD_T    int
 #define THEORAPLAY_MUTEX_T     int
+#define THEORAPLAY_SEM_T       int
 #else
 #include <pthread.h>
 #include <unistd.h>
-#define sleepms(x) usleep((x) * 1000)
+#if defined(__APPLE__)
+#include <pthread/qos.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#endif
 #define THEORAPLAY_THREAD_T    pthread_t
 #define THEORAPLAY_MUTEX_T     pthread_mutex_t *
+#define THEORAPLAY_SEM_T       struct ThreadSemaphore *
+#endif
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__) && !defined(THEORAPLAY_NO_MMAP)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define THEORAPLAY_HAVE_MMAP 1
 #endif
 
 #if defined(__ARM_NEON__) || defined(__ARM_NEON)
 #include <arm_neon.h>
 #define THEORAPLAY_HAVE_NEON_INTRINSICS 1
+#if defined(__linux__) && !defined(__aarch64__)
+#include <sys/auxv.h>  /* NEON is optional on 32-bit ARM, so we ask the kernel. */
+#endif
+#endif
+
+// The x86 converters are built with per-function target attributes where the
+//  compiler allows it, so one binary carries every tier and we pick at runtime.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+#include <immintrin.h>
+#include <cpuid.h>
+#define THEORAPLAY_HAVE_SSE2_INTRINSICS 1
+#define THEORAPLAY_HAVE_AVX2_INTRINSICS 1
+#define THEORAPLAY_SSE2_TARGET __attribute__((target("sse2")))
+#define THEORAPLAY_AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#if defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define THEORAPLAY_HAVE_SSE2_INTRINSICS 1
+#endif
+#if (_MSC_VER >= 1800)  /* Visual Studio 2013 can emit AVX2 without /arch:AVX2. */
+#define THEORAPLAY_HAVE_AVX2_INTRINSICS 1
+#endif
+#define THEORAPLAY_SSE2_TARGET
+#define THEORAPLAY_AVX2_TARGET
 #endif
 
 #ifndef THEORAPLAY_ONLY_SINGLE_THREADED
 #define THEORAPLAY_ONLY_SINGLE_THREADED 0
 #endif
 
+// State shared between threads without a lock. C11 atomics where we have
+//  them, compiler intrinsics elsewhere. See the Atomic* functions below.
+#if THEORAPLAY_ONLY_SINGLE_THREADED
+#define THEORAPLAY_ATOMIC_UINT unsigned int
+#define THEORAPLAY_ATOMIC_PTR  void *
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define THEORAPLAY_USE_C11_ATOMICS 1
+#define THEORAPLAY_ATOMIC_UINT atomic_uint
+#define THEORAPLAY_ATOMIC_PTR  _Atomic(void *)
+#elif defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER)
+#define THEORAPLAY_ATOMIC_UINT volatile unsigned int
+#define THEORAPLAY_ATOMIC_PTR  void * volatile
+#else
+#error Please define atomics for this platform.
+#endif
+
 #include "theoraplay.h"
 #include "theora/theoradec.h"
 #include "vorbis/codec.h"
@@ -52,10 +114,13 @@ typedef THEORAPLAY_AudioPacket AudioPacket;
 
 // !!! FIXME: these all count on the pixel format being TH_PF_420 for now.
 
-typedef unsigned char *(*ConvertVideoFrameFn)(const THEORAPLAY_Allocator *allocator, const th_info *tinfo, const th_ycbcr_buffer ycbcr);
+// Converters fill rows [firstrow, endrow) of an already-allocated frame, so
+//  a frame can be split into bands and converted on several threads at once.
+//  firstrow is always even, since each line of Cb/Cr covers two rows of Y'.
+typedef void (*ConvertVideoFrameFn)(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char *pixels, const int firstrow, const int endrow);
 
-static unsigned char *ConvertVideoFrame420ToYUVPlanar(const THEORAPLAY_Allocator *allocator,
-                            const th_info *tinfo, const th_ycbcr_buffer ycbcr,
+static void ConvertVideoFrame420ToYUVPlanar(const th_info *tinfo, const th_ycbcr_buffer ycbcr,
+                            unsigned char *yuv, const int firstrow, const int endrow,
                             const int p0, const int p1, const int p2)
 {
     int i;
@@ -63,41 +128,172 @@ static unsigned char *ConvertVideoFrame420ToYUVPlanar(const THEORAPLAY_Allocator
     const int h = tinfo->pic_height;
     const int yoff = (tinfo->pic_x & ~1) + ycbcr[0].stride * (tinfo->pic_y & ~1);
     const int uvoff = (tinfo->pic_x / 2) + (ycbcr[1].stride) * (tinfo->pic_y / 2);
-    unsigned char *yuv = (unsigned char *) allocator->allocate(allocator, w * h * 2);
     const unsigned char *p0data = ycbcr[p0].data + yoff;
     const int p0stride = ycbcr[p0].stride;
     const unsigned char *p1data = ycbcr[p1].data + uvoff;
     const int p1stride = ycbcr[p1].stride;
     const unsigned char *p2data = ycbcr[p2].data + uvoff;
     const int p2stride = ycbcr[p2].stride;
-
-    if (yuv)
-    {
-        unsigned char *dst = yuv;
-        for (i = 0; i < h; i++, dst += w)
-            memcpy(dst, p0data + (p0stride * i), w);
-        for (i = 0; i < (h / 2); i++, dst += w/2)
-            memcpy(dst, p1data + (p1stride * i), w / 2);
-        for (i = 0; i < (h / 2); i++, dst += w/2)
-            memcpy(dst, p2data + (p2stride * i), w / 2);
-    } // if
-
-    return yuv;
+    const int uvend = (endrow < h) ? (endrow / 2) : (h / 2);
+    unsigned char *dst;
+
+    dst = yuv + (w * firstrow);
+    for (i = firstrow; i < endrow; i++, dst += w)
+        memcpy(dst, p0data + (p0stride * i), w);
+    dst = yuv + (w * h) + ((w / 2) * (firstrow / 2));
+    for (i = firstrow / 2; i < uvend; i++, dst += w/2)
+        memcpy(dst, p1data + (p1stride * i), w / 2);
+    dst = yuv + (w * h) + ((w / 2) * (h / 2)) + ((w / 2) * (firstrow / 2));
+    for (i = firstrow / 2; i < uvend; i++, dst += w/2)
+        memcpy(dst, p2data + (p2stride * i), w / 2);
 } // ConvertVideoFrame420ToYUVPlanar
 
 
-static unsigned char *ConvertVideoFrame420ToYV12(const THEORAPLAY_Allocator *allocator, const th_info *tinfo, const th_ycbcr_buffer ycbcr)
+static void ConvertVideoFrame420ToYV12(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char *pixels, const int firstrow, const int endrow)
 {
-    return ConvertVideoFrame420ToYUVPlanar(allocator, tinfo, ycbcr, 0, 2, 1);
+    ConvertVideoFrame420ToYUVPlanar(tinfo, ycbcr, pixels, firstrow, endrow, 0, 2, 1);
 } // ConvertVideoFrame420ToYV12
 
 
-static unsigned char *ConvertVideoFrame420ToIYUV(const THEORAPLAY_Allocator *allocator, const th_info *tinfo, const th_ycbcr_buffer ycbcr)
+static void ConvertVideoFrame420ToIYUV(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char *pixels, const int firstrow, const int endrow)
 {
-    return ConvertVideoFrame420ToYUVPlanar(allocator, tinfo, ycbcr, 0, 1, 2);
+    ConvertVideoFrame420ToYUVPlanar(tinfo, ycbcr, pixels, firstrow, endrow, 0, 1, 2);
 } // ConvertVideoFrame420ToIYUV
 
 
+// How much memory a converted frame needs. The RGB converters always write
+//  rows in pairs, so odd heights get an extra row of slack at the end.
+static unsigned int VideoFrameBufferSize(const THEORAPLAY_VideoFormat vidfmt, const th_info *tinfo)
+{
+    const unsigned int w = tinfo->pic_width;
+    const unsigned int h = tinfo->pic_height;
+    const unsigned int evenh = (h + 1) & ~1;
+    switch (vidfmt)
+    {
+        case THEORAPLAY_VIDFMT_YV12:
+        case THEORAPLAY_VIDFMT_IYUV: return w * h * 2;
+        case THEORAPLAY_VIDFMT_RGB: return w * evenh * 3;
+        case THEORAPLAY_VIDFMT_RGBA:
+        case THEORAPLAY_VIDFMT_BGRA: return w * evenh * 4;
+        case THEORAPLAY_VIDFMT_RGB565: return w * evenh * 2;
+        case THEORAPLAY_VIDFMT_PLANES: break;  // depends on the decoder's strides; see CopyVideoFramePlanes().
+    } // switch
+    return 0;
+} // VideoFrameBufferSize
+
+
+// Point a converted frame's planes[] at its pixels, so apps can use the
+//  same plane-walking code for every format.
+static void SetVideoFramePlanes(VideoFrame *item)
+{
+    const unsigned int w = item->width;
+    const unsigned int h = item->height;
+    unsigned int bpp = 0;
+
+    memset(item->planes, '\0', sizeof (item->planes));
+
+    switch (item->format)
+    {
+        case THEORAPLAY_VIDFMT_YV12:
+        case THEORAPLAY_VIDFMT_IYUV:
+        {
+            unsigned char *cb = item->pixels + (w * h);
+            unsigned char *cr = cb + ((w / 2) * (h / 2));
+            if (item->format == THEORAPLAY_VIDFMT_YV12)
+            {
+                unsigned char *tmp = cb;  // YV12 stores Cr first.
+                cb = cr;
+                cr = tmp;
+            } // if
+            item->planes[0].data = item->pixels;
+            item->planes[0].stride = (int) w;
+            item->planes[0].width = w;
+            item->planes[0].height = h;
+            item->planes[1].data = cb;
+            item->planes[2].data = cr;
+            item->planes[1].stride = item->planes[2].stride = (int) (w / 2);
+            item->planes[1].width = item->planes[2].width = w / 2;
+            item->planes[1].height = item->planes[2].height = h / 2;
+            return;
+        } // case
+
+        case THEORAPLAY_VIDFMT_RGB: bpp = 3; break;
+        case THEORAPLAY_VIDFMT_RGBA:
+        case THEORAPLAY_VIDFMT_BGRA: bpp = 4; break;
+        case THEORAPLAY_VIDFMT_RGB565: bpp = 2; break;
+        case THEORAPLAY_VIDFMT_PLANES: return;  // CopyVideoFramePlanes() did it.
+    } // switch
+
+    item->planes[0].data = item->pixels;
+    item->planes[0].stride = (int) (w * bpp);
+    item->planes[0].width = w;
+    item->planes[0].height = h;
+} // SetVideoFramePlanes
+
+
+// THEORAPLAY_VIDFMT_PLANES doesn't repack anything: each plane is one bulk
+//  copy of the decoder's rows that cover the picture, keeping its stride
+//  (and row padding). libtheora reuses its buffers for the next frame, so
+//  we can't just hand out its pointers, but this is a single memcpy per
+//  plane instead of one per row, and apps can upload it with the stride.
+#define PLANE_ALIGN 16
+
+static void GetPlaneLayout(const th_info *tinfo, const th_ycbcr_buffer ycbcr, const int plane,
+                           const unsigned char **low, const unsigned char **first,
+                           unsigned int *len, unsigned int *pw, unsigned int *ph)
+{
+    const unsigned int x0 = plane ? (tinfo->pic_x / 2) : tinfo->pic_x;
+    const unsigned int y0 = plane ? (tinfo->pic_y / 2) : tinfo->pic_y;
+    const unsigned int w = plane ? ((tinfo->pic_width + 1) / 2) : tinfo->pic_width;
+    const unsigned int h = plane ? ((tinfo->pic_height + 1) / 2) : tinfo->pic_height;
+    const int stride = ycbcr[plane].stride;
+    const unsigned int absstride = (unsigned int) ((stride < 0) ? -stride : stride);
+    const unsigned char *top = ycbcr[plane].data + ((long) stride * y0);
+    const unsigned char *bottom = top + ((long) stride * (h ? (h - 1) : 0));
+
+    *first = top;
+    *low = (stride < 0) ? bottom : top;
+    *len = (absstride * (h ? (h - 1) : 0)) + x0 + w;
+    *pw = w;
+    *ph = h;
+} // GetPlaneLayout
+
+static unsigned int PlanesBufferSize(const th_info *tinfo, const th_ycbcr_buffer ycbcr)
+{
+    unsigned int total = 0;
+    int i;
+    for (i = 0; i < 3; i++)
+    {
+        const unsigned char *low, *first;
+        unsigned int len, pw, ph;
+        GetPlaneLayout(tinfo, ycbcr, i, &low, &first, &len, &pw, &ph);
+        total += (len + (PLANE_ALIGN - 1)) & ~(PLANE_ALIGN - 1);
+    } // for
+    return total + PLANE_ALIGN;  // slack to align the first plane.
+} // PlanesBufferSize
+
+static void CopyVideoFramePlanes(const th_info *tinfo, const th_ycbcr_buffer ycbcr, VideoFrame *item)
+{
+    unsigned char *dst = item->pixels;
+    int i;
+
+    dst += (PLANE_ALIGN - (((size_t) dst) & (PLANE_ALIGN - 1))) & (PLANE_ALIGN - 1);
+    for (i = 0; i < 3; i++)
+    {
+        const unsigned char *low, *first;
+        unsigned int len, pw, ph;
+        const unsigned int x0 = i ? (tinfo->pic_x / 2) : tinfo->pic_x;
+        GetPlaneLayout(tinfo, ycbcr, i, &low, &first, &len, &pw, &ph);
+        memcpy(dst, low, len);
+        item->planes[i].data = dst + (first - low) + x0;
+        item->planes[i].stride = ycbcr[i].stride;
+        item->planes[i].width = pw;
+        item->planes[i].height = ph;
+        dst += (len + (PLANE_ALIGN - 1)) & ~(PLANE_ALIGN - 1);
+    } // for
+} // CopyVideoFramePlanes
+
+
 // RGB
 #define THEORAPLAY_CVT_FNNAME_420 ConvertVideoFrame420ToRGB
 #define THEORAPLAY_CVT_RGB_DST_BUFFER_SIZE(w, h) ((w) * (h) * 3)
@@ -129,6 +325,58 @@ static unsigned char *ConvertVideoFrame420ToIYUV(const THEORAPLAY_Allocator *all
     dst += 12; \
 }
 #endif
+#ifdef THEORAPLAY_HAVE_SSE2_INTRINSICS
+#define THEORAPLAY_CVT_RGB_KEEP_SCALAR_DEFINES 1
+#include "theoraplay_cvtrgb.h"  /* build out the previous version. */
+#define THEORAPLAY_CVT_FNNAME_420 ConvertVideoFrame420ToRGB_SSE2
+#define THEORAPLAY_CVT_RGB_USE_SSE2 1
+#define THEORAPLAY_CVT_RGB_FNATTR THEORAPLAY_SSE2_TARGET
+/* SSE2 can't shuffle bytes, so squeeze the alpha out of each pair of RGBA pixels with 64-bit shifts, then
+   close the gap between the two pairs. The first 4 pixels store 16 bytes; the last 4 overwrite the junk. */
+#define THEORAPLAY_CVT_RGB_SSE2_PACK_RGB(out, rgba_x4) { \
+    const __m128i vpairs = _mm_or_si128(_mm_and_si128(rgba_x4, _mm_set1_epi64x(0x0000000000FFFFFFLL)), _mm_and_si128(_mm_srli_epi64(rgba_x4, 8), _mm_set1_epi64x(0x0000FFFFFF000000LL))); \
+    out = _mm_or_si128(_mm_and_si128(vpairs, _mm_set_epi64x(0, -1)), _mm_srli_si128(_mm_and_si128(vpairs, _mm_set_epi64x(-1, 0)), 2)); \
+}
+#define THEORAPLAY_CVT_RGB_OUTPUT_SSE2(dst, r, g, b) { \
+    const __m128i vrg = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_packus_epi16(g, g)); \
+    const __m128i vba = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_set1_epi8((char) 0xFF)); \
+    __m128i vrgb1, vrgb2; \
+    int last4; \
+    THEORAPLAY_CVT_RGB_SSE2_PACK_RGB(vrgb1, _mm_unpacklo_epi16(vrg, vba)); \
+    THEORAPLAY_CVT_RGB_SSE2_PACK_RGB(vrgb2, _mm_unpackhi_epi16(vrg, vba)); \
+    last4 = _mm_cvtsi128_si32(_mm_srli_si128(vrgb2, 8)); \
+    _mm_storeu_si128((__m128i *) dst, vrgb1); \
+    _mm_storel_epi64((__m128i *) (dst + 12), vrgb2); \
+    memcpy(dst + 20, &last4, 4); \
+    dst += 24; \
+}
+#endif
+#ifdef THEORAPLAY_HAVE_AVX2_INTRINSICS
+#define THEORAPLAY_CVT_RGB_KEEP_SCALAR_DEFINES 1
+#include "theoraplay_cvtrgb.h"  /* build out the previous version. */
+#define THEORAPLAY_CVT_FNNAME_420 ConvertVideoFrame420ToRGB_AVX2
+#define THEORAPLAY_CVT_RGB_USE_AVX2 1
+#define THEORAPLAY_CVT_RGB_FNATTR THEORAPLAY_AVX2_TARGET
+/* shuffle the alpha out of each group of 4 pixels; every store but the last is 16 bytes and the next store overwrites its junk. */
+#define THEORAPLAY_CVT_RGB_OUTPUT_AVX2(dst, r, g, b) { \
+    const __m256i vshuf = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1); \
+    const __m256i vr = _mm256_packus_epi16(r, r); \
+    const __m256i vg = _mm256_packus_epi16(g, g); \
+    const __m256i vb = _mm256_packus_epi16(b, b); \
+    const __m256i vrg = _mm256_unpacklo_epi8(vr, vg); \
+    const __m256i vba = _mm256_unpacklo_epi8(vb, _mm256_set1_epi8((char) 0xFF)); \
+    const __m256i vlo = _mm256_shuffle_epi8(_mm256_unpacklo_epi16(vrg, vba), vshuf);  /* pixels 0-3, 8-11 */ \
+    const __m256i vhi = _mm256_shuffle_epi8(_mm256_unpackhi_epi16(vrg, vba), vshuf);  /* pixels 4-7, 12-15 */ \
+    const __m128i vlast = _mm256_extracti128_si256(vhi, 1); \
+    const int last4 = _mm_cvtsi128_si32(_mm_srli_si128(vlast, 8)); \
+    _mm_storeu_si128((__m128i *) dst, _mm256_castsi256_si128(vlo)); \
+    _mm_storeu_si128((__m128i *) (dst + 12), _mm256_castsi256_si128(vhi)); \
+    _mm_storeu_si128((__m128i *) (dst + 24), _mm256_extracti128_si256(vlo, 1)); \
+    _mm_storel_epi64((__m128i *) (dst + 36), vlast); \
+    memcpy(dst + 44, &last4, 4); \
+    dst += 48; \
+}
+#endif
 #include "theoraplay_cvtrgb.h"
 
 // RGBA
@@ -147,6 +395,37 @@ static unsigned char *ConvertVideoFrame420ToIYUV(const THEORAPLAY_Allocator *all
 #define THEORAPLAY_CVT_RGB_USE_NEON 1
 #define THEORAPLAY_CVT_RGB_OUTPUT_NEON(dst, rgba_x4) { vst1q_u8(dst, rgba_x4); dst += 16; }
 #endif
+#ifdef THEORAPLAY_HAVE_SSE2_INTRINSICS
+#define THEORAPLAY_CVT_RGB_KEEP_SCALAR_DEFINES 1
+#include "theoraplay_cvtrgb.h"  /* build out the previous version. */
+#define THEORAPLAY_CVT_FNNAME_420 ConvertVideoFrame420ToRGBA_SSE2
+#define THEORAPLAY_CVT_RGB_USE_SSE2 1
+#define THEORAPLAY_CVT_RGB_FNATTR THEORAPLAY_SSE2_TARGET
+#define THEORAPLAY_CVT_RGB_OUTPUT_SSE2(dst, r, g, b) { \
+    const __m128i vrg = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_packus_epi16(g, g)); \
+    const __m128i vba = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_set1_epi8((char) 0xFF)); \
+    _mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi16(vrg, vba)); \
+    _mm_storeu_si128((__m128i *) (dst + 16), _mm_unpackhi_epi16(vrg, vba)); \
+    dst += 32; \
+}
+#endif
+#ifdef THEORAPLAY_HAVE_AVX2_INTRINSICS
+#define THEORAPLAY_CVT_RGB_KEEP_SCALAR_DEFINES 1
+#include "theoraplay_cvtrgb.h"  /* build out the previous version. */
+#define THEORAPLAY_CVT_FNNAME_420 ConvertVideoFrame420ToRGBA_AVX2
+#define THEORAPLAY_CVT_RGB_USE_AVX2 1
+#define THEORAPLAY_CVT_RGB_FNATTR THEORAPLAY_AVX2_TARGET
+/* unpacks stay inside 128-bit lanes, so we end up with pixels 0-3,8-11 and 4-7,12-15; swap lanes before storing. */
+#define THEORAPLAY_CVT_RGB_OUTPUT_AVX2(dst, r, g, b) { \
+    const __m256i vrg = _mm256_unpacklo_epi8(_mm256_packus_epi16(r, r), _mm256_packus_epi16(g, g)); \
+    const __m256i vba = _mm256_unpacklo_epi8(_mm256_packus_epi16(b, b), _mm256_set1_epi8((char) 0xFF)); \
+    const __m256i vlo = _mm256_unpacklo_epi16(vrg, vba); \
+    const __m256i vhi = _mm256_unpackhi_epi16(vrg, vba); \
+    _mm256_storeu_si256((__m256i *) dst, _mm256_permute2x128_si256(vlo, vhi, 0x20)); \
+    _mm256_storeu_si256((__m256i *) (dst + 32), _mm256_permute2x128_si256(vlo, vhi, 0x31)); \
+    dst += 64; \
+}
+#endif
 #include "theoraplay_cvtrgb.h"
 
 // BGRA
@@ -174,6 +453,36 @@ static unsigned char *ConvertVideoFrame420ToIYUV(const THEORAPLAY_Allocator *all
     dst += 16; \
 }
 #endif
+#ifdef THEORAPLAY_HAVE_SSE2_INTRINSICS
+#define THEORAPLAY_CVT_RGB_KEEP_SCALAR_DEFINES 1
+#include "theoraplay_cvtrgb.h"  /* build out the previous version. */
+#define THEORAPLAY_CVT_FNNAME_420 ConvertVideoFrame420ToBGRA_SSE2
+#define THEORAPLAY_CVT_RGB_USE_SSE2 1
+#define THEORAPLAY_CVT_RGB_FNATTR THEORAPLAY_SSE2_TARGET
+#define THEORAPLAY_CVT_RGB_OUTPUT_SSE2(dst, r, g, b) { \
+    const __m128i vbg = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_packus_epi16(g, g)); \
+    const __m128i vra = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_set1_epi8((char) 0xFF)); \
+    _mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi16(vbg, vra)); \
+    _mm_storeu_si128((__m128i *) (dst + 16), _mm_unpackhi_epi16(vbg, vra)); \
+    dst += 32; \
+}
+#endif
+#ifdef THEORAPLAY_HAVE_AVX2_INTRINSICS
+#define THEORAPLAY_CVT_RGB_KEEP_SCALAR_DEFINES 1
+#include "theoraplay_cvtrgb.h"  /* build out the previous version. */
+#define THEORAPLAY_CVT_FNNAME_420 ConvertVideoFrame420ToBGRA_AVX2
+#define THEORAPLAY_CVT_RGB_USE_AVX2 1
+#define THEORAPLAY_CVT_RGB_FNATTR THEORAPLAY_AVX2_TARGET
+#define THEORAPLAY_CVT_RGB_OUTPUT_AVX2(dst, r, g, b) { \
+    const __m256i vbg = _mm256_unpacklo_epi8(_mm256_packus_epi16(b, b), _mm256_packus_epi16(g, g)); \
+    const __m256i vra = _mm256_unpacklo_epi8(_mm256_packus_epi16(r, r), _mm256_set1_epi8((char) 0xFF)); \
+    const __m256i vlo = _mm256_unpacklo_epi16(vbg, vra); \
+    const __m256i vhi = _mm256_unpackhi_epi16(vbg, vra); \
+    _mm256_storeu_si256((__m256i *) dst, _mm256_permute2x128_si256(vlo, vhi, 0x20)); \
+    _mm256_storeu_si256((__m256i *) (dst + 32), _mm256_permute2x128_si256(vlo, vhi, 0x31)); \
+    dst += 64; \
+}
+#endif
 #include "theoraplay_cvtrgb.h"
 
 // RGB565
@@ -204,42 +513,380 @@ static unsigned char *ConvertVideoFrame420ToIYUV(const THEORAPLAY_Allocator *all
     dst += 8; \
 }
 #endif
+#ifdef THEORAPLAY_HAVE_SSE2_INTRINSICS
+#define THEORAPLAY_CVT_RGB_KEEP_SCALAR_DEFINES 1
+#include "theoraplay_cvtrgb.h"  /* build out the previous version. */
+#define THEORAPLAY_CVT_FNNAME_420 ConvertVideoFrame420ToRGB565_SSE2
+#define THEORAPLAY_CVT_RGB_USE_SSE2 1
+#define THEORAPLAY_CVT_RGB_FNATTR THEORAPLAY_SSE2_TARGET
+/* the components are already 16 bits wide, so clamp and bitshift them right in the registers. */
+#define THEORAPLAY_CVT_RGB_OUTPUT_SSE2(dst, r, g, b) { \
+    const __m128i vzero = _mm_setzero_si128(); \
+    const __m128i vmax = _mm_set1_epi16(255); \
+    const __m128i vr = _mm_slli_epi16(_mm_and_si128(_mm_min_epi16(_mm_max_epi16(r, vzero), vmax), _mm_set1_epi16(0xF8)), 8); \
+    const __m128i vg = _mm_slli_epi16(_mm_and_si128(_mm_min_epi16(_mm_max_epi16(g, vzero), vmax), _mm_set1_epi16(0xFC)), 3); \
+    const __m128i vb = _mm_srli_epi16(_mm_min_epi16(_mm_max_epi16(b, vzero), vmax), 3); \
+    _mm_storeu_si128((__m128i *) dst, _mm_or_si128(_mm_or_si128(vr, vg), vb)); \
+    dst += 16; \
+}
+#endif
+#ifdef THEORAPLAY_HAVE_AVX2_INTRINSICS
+#define THEORAPLAY_CVT_RGB_KEEP_SCALAR_DEFINES 1
+#include "theoraplay_cvtrgb.h"  /* build out the previous version. */
+#define THEORAPLAY_CVT_FNNAME_420 ConvertVideoFrame420ToRGB565_AVX2
+#define THEORAPLAY_CVT_RGB_USE_AVX2 1
+#define THEORAPLAY_CVT_RGB_FNATTR THEORAPLAY_AVX2_TARGET
+#define THEORAPLAY_CVT_RGB_OUTPUT_AVX2(dst, r, g, b) { \
+    const __m256i vzero = _mm256_setzero_si256(); \
+    const __m256i vmax = _mm256_set1_epi16(255); \
+    const __m256i vr = _mm256_slli_epi16(_mm256_and_si256(_mm256_min_epi16(_mm256_max_epi16(r, vzero), vmax), _mm256_set1_epi16(0xF8)), 8); \
+    const __m256i vg = _mm256_slli_epi16(_mm256_and_si256(_mm256_min_epi16(_mm256_max_epi16(g, vzero), vmax), _mm256_set1_epi16(0xFC)), 3); \
+    const __m256i vb = _mm256_srli_epi16(_mm256_min_epi16(_mm256_max_epi16(b, vzero), vmax), 3); \
+    _mm256_storeu_si256((__m256i *) dst, _mm256_or_si256(_mm256_or_si256(vr, vg), vb)); \
+    dst += 32; \
+}
+#endif
 #include "theoraplay_cvtrgb.h"
 
-// !!! FIXME: these volatiles really need to become atomics.
+static THEORAPLAY_ConvertTier requested_cvttier = THEORAPLAY_CVTTIER_AUTO;
+
+static int CPUHasConvertTier(const THEORAPLAY_ConvertTier tier)
+{
+    switch (tier)
+    {
+        case THEORAPLAY_CVTTIER_SCALAR:
+            return 1;
+
+        #if defined(THEORAPLAY_HAVE_SSE2_INTRINSICS) && (defined(__x86_64__) || defined(_M_X64))
+        case THEORAPLAY_CVTTIER_SSE2:
+            return 1;  // always there on x86-64.
+        #elif defined(THEORAPLAY_HAVE_SSE2_INTRINSICS) && defined(_MSC_VER)
+        case THEORAPLAY_CVTTIER_SSE2:
+        {
+            int info[4];
+            __cpuid(info, 1);
+            return (info[3] & (1 << 26)) != 0;
+        }
+        #elif defined(THEORAPLAY_HAVE_SSE2_INTRINSICS)
+        case THEORAPLAY_CVTTIER_SSE2:
+        {
+            unsigned int eax, ebx, ecx, edx;
+            return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && ((edx & bit_SSE2) != 0);
+        }
+        #endif
+
+        // AVX2 needs the CPU to have it _and_ the OS to save the YMM registers on context switches.
+        #if defined(THEORAPLAY_HAVE_AVX2_INTRINSICS) && defined(_MSC_VER)
+        case THEORAPLAY_CVTTIER_AVX2:
+        {
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7)
+                return 0;
+            __cpuid(info, 1);
+            if (((info[2] & (1 << 27)) == 0) || ((info[2] & (1 << 28)) == 0))  // OSXSAVE, AVX
+                return 0;
+            else if ((_xgetbv(0) & 0x6) != 0x6)
+                return 0;
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+        }
+        #elif defined(THEORAPLAY_HAVE_AVX2_INTRINSICS)
+        case THEORAPLAY_CVTTIER_AVX2:
+        {
+            unsigned int eax, ebx, ecx, edx;
+            unsigned int xcr0, xcr0hi;
+            if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+                return 0;
+            else if (((ecx & bit_OSXSAVE) == 0) || ((ecx & bit_AVX) == 0))
+                return 0;
+            __asm__ __volatile__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0hi) : "c" (0));
+            if ((xcr0 & 0x6) != 0x6)
+                return 0;
+            else if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+                return 0;
+            return (ebx & bit_AVX2) != 0;
+        }
+        #endif
+
+        #if defined(THEORAPLAY_HAVE_NEON_INTRINSICS) && defined(__linux__) && !defined(__aarch64__)
+        case THEORAPLAY_CVTTIER_NEON:
+        {
+            #ifndef HWCAP_NEON
+            #define HWCAP_NEON (1 << 12)
+            #endif
+            return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+        }
+        #elif defined(THEORAPLAY_HAVE_NEON_INTRINSICS)
+        case THEORAPLAY_CVTTIER_NEON:
+            return 1;  // mandatory on arm64, and we were built for it elsewhere.
+        #endif
+
+        default: break;
+    } // switch
+
+    return 0;
+} // CPUHasConvertTier
+
+static THEORAPLAY_ConvertTier ChooseConvertTier(void)
+{
+    THEORAPLAY_ConvertTier tier = requested_cvttier;
+
+    if (tier == THEORAPLAY_CVTTIER_AUTO)
+    {
+        const char *env = getenv("THEORAPLAY_CONVERT_TIER");
+        if (env == NULL) {}  // leave it alone.
+        else if (strcmp(env, "scalar") == 0) tier = THEORAPLAY_CVTTIER_SCALAR;
+        else if (strcmp(env, "sse2") == 0) tier = THEORAPLAY_CVTTIER_SSE2;
+        else if (strcmp(env, "avx2") == 0) tier = THEORAPLAY_CVTTIER_AVX2;
+        else if (strcmp(env, "neon") == 0) tier = THEORAPLAY_CVTTIER_NEON;
+    } // if
+
+    if (tier == THEORAPLAY_CVTTIER_AUTO)
+        tier = THEORAPLAY_CVTTIER_NEON;  // start at the top and work down.
+
+    while ((tier > THEORAPLAY_CVTTIER_SCALAR) && !CPUHasConvertTier(tier))
+        tier = (THEORAPLAY_ConvertTier) (tier - 1);
+
+    return tier;
+} // ChooseConvertTier
+
+typedef struct ConvertHelper
+{
+    struct TheoraDecoder *ctx;
+    int thread_created;
+    THEORAPLAY_THREAD_T thread;
+    THEORAPLAY_SEM_T go;
+    int firstrow;
+    int endrow;
+    unsigned char *scalescratch;  // this thread's, for ConvertRows().
+} ConvertHelper;
+
+// The decoder reuses its plane buffers on the next packet, so frames handed
+//  to the pipelined conversion stage carry their own copy of the planes.
+typedef struct PipelineSlot
+{
+    VideoFrame *item;
+    th_ycbcr_buffer ycbcr;
+    unsigned char *planes;
+    unsigned int planeslen;
+} PipelineSlot;
+
+#define PIPELINE_SLOTS 2
+
+// Video frames get recycled instead of allocated fresh for every picture.
+//  Each frame remembers its pool, so THEORAPLAY_freeVideo() can give it back,
+//  and the pool hangs around after THEORAPLAY_stopDecode() until the app
+//  frees the last frame it was holding.
+typedef struct FramePool FramePool;
+
+typedef struct PooledVideoFrame
+{
+    VideoFrame frame;  // must be first!
+    FramePool *pool;
+    unsigned int pixelslen;
+} PooledVideoFrame;
+
+struct FramePool
+{
+    THEORAPLAY_Allocator allocator;
+    THEORAPLAY_MUTEX_T lock;
+    VideoFrame *available;  // chained through VideoFrame::next.
+    unsigned int availablecount;
+    unsigned int capacity;  // most frames we'll keep around; 0 once the decoder is gone.
+    unsigned int refcount;  // the decoder, plus every frame out of the pool.
+    unsigned long hits;
+    unsigned long misses;
+};
+
+// Audio packets carry a copy of the allocator that made them, so
+//  THEORAPLAY_freeAudio() can hand the memory back to it, even after the
+//  decoder is gone.
+typedef struct AllocatedAudioPacket
+{
+    AudioPacket packet;  // must be first!
+    THEORAPLAY_Allocator allocator;
+} AllocatedAudioPacket;
+
+// Frames in flight beyond maxframes: the pipeline's slots, plus a couple the app is holding.
+#define FRAME_POOL_SLACK (PIPELINE_SLOTS + 2)
+
+// Single-producer/single-consumer queue. The decoding thread (or the
+//  pipeline thread) pushes, the app pops, and neither takes a lock. It's a
+//  chain of fixed-size blocks: the producer fills each block once, front to
+//  back, then links a new one; the consumer hands each emptied block back
+//  as a spare, so in steady state nothing gets allocated.
+typedef struct QueueBlock
+{
+    THEORAPLAY_ATOMIC_PTR next;  // set by the producer once this block is full.
+    THEORAPLAY_ATOMIC_UINT tail;  // slots filled; only the producer writes this.
+    unsigned int head;  // slots consumed; only the consumer touches this.
+    void *slots[1];  // really ItemQueue::blockslots long.
+} QueueBlock;
+
+typedef struct ItemQueue
+{
+    const THEORAPLAY_Allocator *allocator;
+    QueueBlock *readblock;  // consumer's.
+    QueueBlock *writeblock;  // producer's.
+    THEORAPLAY_ATOMIC_PTR spare;  // an emptied block on its way back to the producer.
+    THEORAPLAY_ATOMIC_UINT count;  // never less than what's actually queued.
+    unsigned int blockslots;
+} ItemQueue;
+
+#define AUDIO_QUEUE_BLOCK_SLOTS 64
+
+// Where we've seen pages of the stream we seek by (video if we have it,
+//  audio otherwise), so seeks can jump straight to a keyframe instead of
+//  bisecting the file. Sorted by offset, which also sorts by granulepos.
+//  We only see the parts of the stream we've read, so there are holes
+//  wherever we seeked past something; "joined" marks where there aren't.
+typedef struct SeekIndexEntry
+{
+    ogg_int64_t offset;  // byte offset of the page.
+    ogg_int64_t granulepos;  // of the last packet that finishes on the page.
+    int joined;  // the entry before this one is the page before it (for the first entry: reading from offset 0 gets here).
+} SeekIndexEntry;
+
+// What came before a page we index, if it isn't another indexed page.
+#define SEEKINDEX_GAP -1  // we don't know; we jumped or skipped something.
+#define SEEKINDEX_TOP -2  // nothing; we read everything from offset 0.
+
+typedef struct SeekIndex
+{
+    SeekIndexEntry *entries;
+    unsigned int len;
+    unsigned int cap;
+} SeekIndex;
+
+// An Ogg Skeleton 4 keyframe index for one stream, from the file itself.
+//  Each keypoint is where to start reading to decode a keyframe.
+typedef struct SkeletonKeypoint
+{
+    ogg_int64_t offset;
+    ogg_int64_t ms;  // the keyframe's presentation time.
+} SkeletonKeypoint;
+
+// THEORAPLAY_PPLEVEL_ADAPTIVE, as ctx->pprequest stores it.
+#define PPLEVEL_ADAPTIVE ((unsigned int) THEORAPLAY_PPLEVEL_ADAPTIVE)
+
+// In adaptive mode, wait this many frames after changing the level before
+//  raising it again, so we don't flap between levels on every frame.
+#define PPLEVEL_SETTLE_FRAMES 30
+
+// How much we ask the Io for at once, unless the app says otherwise.
+#define READ_CHUNK_DEFAULT 4096
+
+// With THEORAPLAY_READSIZE_ADAPTIVE, each read covers about this much of the
+//  stream's playback time, measured once we've played a second or so of it.
+//  Seek probes only want the next page, so they stay small.
+#define READ_CHUNK_MEDIA_MS 100
+#define READ_CHUNK_MAX (256 * 1024)
+#define READ_CHUNK_PROBE READ_CHUNK_DEFAULT
+
+// Biggest read_size we'll take from the app; every read allocates this much
+//  in ogg_sync, so anything bigger just wastes memory (or fails outright).
+#define READ_CHUNK_LIMIT (4 * 1024 * 1024)
+
+// Smallest ring buffer the read-ahead stage will use.
+#define READAHEAD_MIN (16 * 1024)
+
+#define SCRUBKEY_NONE -2  // haven't decoded a keyframe yet.
+#define SCRUBKEY_UNTIMED -1  // decoded one, but don't know its frame number yet.
+
+typedef struct SkeletonIndex
+{
+    SkeletonKeypoint *keypoints;
+    unsigned int len;
+} SkeletonIndex;
+
 typedef struct TheoraDecoder
 {
     // Thread wrangling...
     int thread_created;
-    THEORAPLAY_MUTEX_T lock;
-    volatile int halt;
-    int thread_done;
+    THEORAPLAY_MUTEX_T lock;  // only guards seek requests now.
+    THEORAPLAY_ATOMIC_UINT halt;
+    THEORAPLAY_ATOMIC_UINT thread_done;
     THEORAPLAY_THREAD_T worker;
+    THEORAPLAY_SEM_T wakeworker;  // posted when the worker might have something to do.
+
+    // Shared scheduler, instead of a worker thread of our own...
+    THEORAPLAY_Scheduler *scheduler;
+    struct TheoraDecoder *sched_next;  // this and the next two are guarded by scheduler->lock.
+    int sched_busy;  // a scheduler thread is pumping us right now.
+    int sched_waiting;  // stopDecode is waiting on schedidle for sched_busy to clear.
+    THEORAPLAY_SEM_T schedidle;
 
     // API state...
     THEORAPLAY_Allocator allocator;
-    THEORAPLAY_Io *io;
+    THEORAPLAY_DecoderOptions options;
+    THEORAPLAY_Io64 *io;
     unsigned int maxframes;  // Max video frames to buffer.
-    volatile unsigned int prepped;
-    volatile unsigned int videocount;  // currently buffered frames.
-    volatile unsigned int audioms;  // currently buffered audio samples.
-    volatile int hasvideo;
-    volatile int hasaudio;
-    volatile int decode_error;
-    volatile unsigned int seek_generation;
-    volatile unsigned long new_seek_position_ms;
+    THEORAPLAY_ATOMIC_UINT prepped;
+    THEORAPLAY_ATOMIC_UINT audioms;  // currently buffered audio samples.
+    THEORAPLAY_ATOMIC_UINT hasvideo;
+    THEORAPLAY_ATOMIC_UINT hasaudio;
+    THEORAPLAY_ATOMIC_UINT decode_error;
+    THEORAPLAY_ATOMIC_UINT seek_generation;
+    unsigned long new_seek_position_ms;  // guarded by lock, along with bumping seek_generation.
+    int new_seek_keyframe;  // guarded by lock, too. THEORAPLAY_seekKeyframe() vs THEORAPLAY_seek().
 
     THEORAPLAY_VideoFormat vidfmt;
     ConvertVideoFrameFn vidcvt;
-
-    VideoFrame *videolist;
-    VideoFrame *videolisttail;
-
-    AudioPacket *audiolist;
-    AudioPacket *audiolisttail;
-
-    long streamlen;
+    THEORAPLAY_ConvertTier cvttier;
+    unsigned int outwidth;  // size of the frames we hand out; the picture's, unless we're scaling.
+    unsigned int outheight;
+    th_info outinfo;  // just the picture size, for the converters.
+    int scaling;
+    unsigned char *scalescratch;  // for ConvertRows() on the decoding (or pipeline) thread.
+
+    // Color conversion helper threads...
+    ConvertHelper *cvthelpers;
+    unsigned int cvthelpercount;
+    THEORAPLAY_SEM_T cvtdone;
+    const th_img_plane *cvtycbcr;
+    unsigned char *cvtpixels;
+    int cvthalt;  // posting the helpers' semaphores publishes this.
+
+    FramePool *framepool;
+
+    // Pipelined conversion stage...
+    int pipeline_created;
+    THEORAPLAY_THREAD_T pipeline;
+    THEORAPLAY_SEM_T pipefree;
+    THEORAPLAY_SEM_T pipefull;
+    PipelineSlot pipeslots[PIPELINE_SLOTS];
+    unsigned int pipewriteidx;
+    unsigned int pipereadidx;
+    int pipehalt;  // posting pipefull publishes this.
+    THEORAPLAY_ATOMIC_UINT videopending;  // frames in the pipeline, not in videoqueue yet.
+
+    ItemQueue videoqueue;  // its count is the number of buffered frames.
+    ItemQueue audioqueue;
+
+    ogg_int64_t streamlen;
+    ogg_int64_t syncpos;  // stream offset of the next byte ogg_sync hasn't turned into a page yet.
+    ogg_int64_t pageoffset;  // stream offset of ctx->page.
+    long readchunk;  // bytes per Io read during playback.
+    int adaptiveread;  // readchunk follows the bitrate. Never changes after startup.
+    ogg_int64_t ratepos;  // syncpos when we saw ratems, or -1 if we haven't yet.
+    unsigned long ratems;
+    const unsigned char *mapdata;  // non-NULL if the stream is in memory (mapped or not); we parse pages right out of it.
+    ogg_int64_t maplen;
+    int mmapped;  // mapdata is a file mapping, so it's worth advising the kernel about.
+    ogg_int64_t mapend;  // how much of the mapping we've "fed" so far; pages past here wait.
+    THEORAPLAY_MUTEX_T indexlock;  // guards seekindex; the scanner and the app touch it too.
+    SeekIndex seekindex;
+    ogg_int64_t indexprev;  // offset of the last seek index page we read, or SEEKINDEX_GAP/SEEKINDEX_TOP.
+    ogg_int64_t indexedto;  // syncpos after the last page IndexOggPage saw; anything else means we jumped.
+    THEORAPLAY_THREAD_T scanthread;
+    THEORAPLAY_Io64 *scanio;
+    int scan_created;  // only touched by the app's thread.
+    THEORAPLAY_ATOMIC_UINT scanning;
     unsigned int current_seek_generation;
+    THEORAPLAY_ATOMIC_UINT catchup_frames;  // frames decoded and thrown away reaching the last seek target.
+    THEORAPLAY_ATOMIC_UINT playclock;  // the app's playback time plus one, or 0 if it hasn't told us.
+    THEORAPLAY_ATOMIC_UINT dropped_frames;  // decoded, but too late to bother converting.
     double fps;
     int was_error;
     int eos;
@@ -260,33 +907,52 @@ typedef struct TheoraDecoder
     th_info tinfo;
     th_comment tcomment;
     ogg_stream_state tstream;
+    int skelpackets;  // non-zero until we've read all the Skeleton headers.
+    ogg_stream_state skelstream;
+    ogg_int64_t skelsegmentlen;  // the Skeleton index is stale if this isn't our streamlen.
+    SkeletonIndex tskelindex;
+    SkeletonIndex vskelindex;
     int vblock_init;
     vorbis_block vblock;
     th_dec_ctx *tdec;
+    int pplevel;  // post-processing level for frames we show.
+    int pplevel_applied;  // what tdec is actually set to right now.
+    int ppsettle;  // frames before adaptive mode may raise the level again.
+    int ppahead;  // we filled the app's video queue (and so had to wait on it) since the last frame.
+    THEORAPLAY_ATOMIC_UINT pprequest;  // from the app: a level, or PPLEVEL_ADAPTIVE.
+    THEORAPLAY_ATOMIC_UINT pplevel_max;
+    THEORAPLAY_ATOMIC_UINT pplevel_shown;  // ctx->pplevel, for the app to look at.
     th_setup_info *tsetup;
     ogg_int64_t granulepos;
     int resolving_audio_seek;
     int resolving_video_seek;
     int need_keyframe;
     unsigned long seek_target;
+    int scrubbing;  // this seek only wants the nearest keyframe.
+    int scrub_parked;  // we handed over the keyframe; wait for the next seek.
+    ogg_int64_t scrubkey;  // frame number of the keyframe we're holding, or SCRUBKEY_*.
+    ogg_int64_t scrubnext;  // frame number of the next Theora packet, or -1 if we don't know yet.
     int bos;
 } TheoraDecoder;
 
 
 #if THEORAPLAY_ONLY_SINGLE_THREADED
-static inline int Thread_Create(TheoraDecoder *ctx, void *(*routine) (void*))
+static inline int Thread_Create(THEORAPLAY_THREAD_T *thread, void *(*routine) (void*), void *arg)
 {
-    ctx->worker = 0;
+    *thread = 0;
     return -1;
 }
 static inline void Thread_Join(THEORAPLAY_THREAD_T thread)
 {
 }
-static inline THEORAPLAY_MUTEX_T Mutex_Create(TheoraDecoder *ctx)
+static inline void Thread_LowerPriority(void)
+{
+}
+static inline THEORAPLAY_MUTEX_T Mutex_Create(const THEORAPLAY_Allocator *allocator)
 {
     return (THEORAPLAY_MUTEX_T) (size_t) 0x0001;
 }
-static inline void Mutex_Destroy(TheoraDecoder *ctx, THEORAPLAY_MUTEX_T mutex)
+static inline void Mutex_Destroy(const THEORAPLAY_Allocator *allocator, THEORAPLAY_MUTEX_T mutex)
 {
 }
 static inline void Mutex_Lock(THEORAPLAY_MUTEX_T mutex)
@@ -295,29 +961,46 @@ static inline void Mutex_Lock(THEORAPLAY_MUTEX_T mutex)
 static inline void Mutex_Unlock(THEORAPLAY_MUTEX_T mutex)
 {
 }
+static inline THEORAPLAY_SEM_T Semaphore_Create(const THEORAPLAY_Allocator *allocator)
+{
+    return (THEORAPLAY_SEM_T) (size_t) 0x0001;
+}
+static inline void Semaphore_Destroy(const THEORAPLAY_Allocator *allocator, THEORAPLAY_SEM_T sem)
+{
+}
+static inline void Semaphore_Wait(THEORAPLAY_SEM_T sem)
+{
+}
+static inline void Semaphore_Post(THEORAPLAY_SEM_T sem)
+{
+}
 #elif defined(_WIN32)
-static inline int Thread_Create(TheoraDecoder *ctx, void *(*routine) (void*))
+static inline int Thread_Create(THEORAPLAY_THREAD_T *thread, void *(*routine) (void*), void *arg)
 {
-    ctx->worker = CreateThread(
+    *thread = CreateThread(
         NULL,
         0,
         (LPTHREAD_START_ROUTINE) routine,
-        (LPVOID) ctx,
+        (LPVOID) arg,
         0,
         NULL
     );
-    return (ctx->worker == NULL);
+    return (*thread == NULL);
 }
 static inline void Thread_Join(THEORAPLAY_THREAD_T thread)
 {
     WaitForSingleObject(thread, INFINITE);
     CloseHandle(thread);
 }
-static inline THEORAPLAY_MUTEX_T Mutex_Create(TheoraDecoder *ctx)
+static inline void Thread_LowerPriority(void)
+{
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+}
+static inline THEORAPLAY_MUTEX_T Mutex_Create(const THEORAPLAY_Allocator *allocator)
 {
     return CreateMutex(NULL, FALSE, NULL);
 }
-static inline void Mutex_Destroy(TheoraDecoder *ctx, THEORAPLAY_MUTEX_T mutex)
+static inline void Mutex_Destroy(const THEORAPLAY_Allocator *allocator, THEORAPLAY_MUTEX_T mutex)
 {
     CloseHandle(mutex);
 }
@@ -329,31 +1012,58 @@ static inline void Mutex_Unlock(THEORAPLAY_MUTEX_T mutex)
 {
     ReleaseMutex(mutex);
 }
+static inline THEORAPLAY_SEM_T Semaphore_Create(const THEORAPLAY_Allocator *allocator)
+{
+    return CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+}
+static inline void Semaphore_Destroy(const THEORAPLAY_Allocator *allocator, THEORAPLAY_SEM_T sem)
+{
+    if (sem) {
+        CloseHandle(sem);
+    }
+}
+static inline void Semaphore_Wait(THEORAPLAY_SEM_T sem)
+{
+    WaitForSingleObject(sem, INFINITE);
+}
+static inline void Semaphore_Post(THEORAPLAY_SEM_T sem)
+{
+    ReleaseSemaphore(sem, 1, NULL);
+}
 #else
-static inline int Thread_Create(TheoraDecoder *ctx, void *(*routine) (void*))
+static inline int Thread_Create(THEORAPLAY_THREAD_T *thread, void *(*routine) (void*), void *arg)
 {
-    return pthread_create(&ctx->worker, NULL, routine, ctx);
+    return pthread_create(thread, NULL, routine, arg);
 }
 static inline void Thread_Join(THEORAPLAY_THREAD_T thread)
 {
     pthread_join(thread, NULL);
 }
-static inline THEORAPLAY_MUTEX_T Mutex_Create(TheoraDecoder *ctx)
+// for the calling thread only; there's no portable pthread way to do this.
+static inline void Thread_LowerPriority(void)
+{
+    #if defined(__APPLE__)
+    pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0);
+    #elif defined(__linux__)
+    setpriority(PRIO_PROCESS, 0, 10);  // Linux nice values are per-thread, despite the name.
+    #endif
+}
+static inline THEORAPLAY_MUTEX_T Mutex_Create(const THEORAPLAY_Allocator *allocator)
 {
-    THEORAPLAY_MUTEX_T retval = (THEORAPLAY_MUTEX_T) ctx->allocator.allocate(&ctx->allocator, sizeof (*retval));
+    THEORAPLAY_MUTEX_T retval = (THEORAPLAY_MUTEX_T) allocator->allocate(allocator, sizeof (*retval));
     if (retval) {
         if (pthread_mutex_init(retval, NULL) != 0) {
-            ctx->allocator.deallocate(&ctx->allocator, retval);
+            allocator->deallocate(allocator, retval);
             retval = NULL;
         }
     }
     return retval;
 }
-static inline void Mutex_Destroy(TheoraDecoder *ctx, THEORAPLAY_MUTEX_T mutex)
+static inline void Mutex_Destroy(const THEORAPLAY_Allocator *allocator, THEORAPLAY_MUTEX_T mutex)
 {
     if (mutex) {
         pthread_mutex_destroy(mutex);
-        ctx->allocator.deallocate(&ctx->allocator, mutex);
+        allocator->deallocate(allocator, mutex);
     }
 }
 static inline void Mutex_Lock(THEORAPLAY_MUTEX_T mutex)
@@ -364,573 +1074,3006 @@ static inline void Mutex_Unlock(THEORAPLAY_MUTEX_T mutex)
 {
     pthread_mutex_unlock(mutex);
 }
+// unnamed POSIX semaphores don't exist on macOS, so build our own.
+struct ThreadSemaphore
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned int count;
+};
+static inline THEORAPLAY_SEM_T Semaphore_Create(const THEORAPLAY_Allocator *allocator)
+{
+    THEORAPLAY_SEM_T retval = (THEORAPLAY_SEM_T) allocator->allocate(allocator, sizeof (*retval));
+    if (retval) {
+        retval->count = 0;
+        if (pthread_mutex_init(&retval->mutex, NULL) != 0) {
+            allocator->deallocate(allocator, retval);
+            retval = NULL;
+        } else if (pthread_cond_init(&retval->cond, NULL) != 0) {
+            pthread_mutex_destroy(&retval->mutex);
+            allocator->deallocate(allocator, retval);
+            retval = NULL;
+        }
+    }
+    return retval;
+}
+static inline void Semaphore_Destroy(const THEORAPLAY_Allocator *allocator, THEORAPLAY_SEM_T sem)
+{
+    if (sem) {
+        pthread_cond_destroy(&sem->cond);
+        pthread_mutex_destroy(&sem->mutex);
+        allocator->deallocate(allocator, sem);
+    }
+}
+static inline void Semaphore_Wait(THEORAPLAY_SEM_T sem)
+{
+    pthread_mutex_lock(&sem->mutex);
+    while (sem->count == 0)
+        pthread_cond_wait(&sem->cond, &sem->mutex);
+    sem->count--;
+    pthread_mutex_unlock(&sem->mutex);
+}
+static inline void Semaphore_Post(THEORAPLAY_SEM_T sem)
+{
+    pthread_mutex_lock(&sem->mutex);
+    sem->count++;
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->mutex);
+}
 #endif
 
 
-static int FeedMoreOggData(THEORAPLAY_Io *io, ogg_sync_state *sync)
+// Loads acquire and stores release, so whatever was written before a store
+//  is visible to the thread that loads it.
+#if THEORAPLAY_ONLY_SINGLE_THREADED
+static inline unsigned int AtomicGetUInt(THEORAPLAY_ATOMIC_UINT *a)
 {
-    long buflen = 4096;
-    char *buffer = ogg_sync_buffer(sync, buflen);
-    if (buffer == NULL)
-        return -1;
+    return *a;
+}
+static inline void AtomicSetUInt(THEORAPLAY_ATOMIC_UINT *a, const unsigned int val)
+{
+    *a = val;
+}
+static inline unsigned int AtomicAddUInt(THEORAPLAY_ATOMIC_UINT *a, const unsigned int val)
+{
+    return (*a += val);
+}
+static inline void *AtomicGetPtr(THEORAPLAY_ATOMIC_PTR *a)
+{
+    return *a;
+}
+static inline void AtomicSetPtr(THEORAPLAY_ATOMIC_PTR *a, void *val)
+{
+    *a = val;
+}
+static inline void *AtomicExchangePtr(THEORAPLAY_ATOMIC_PTR *a, void *val)
+{
+    void *retval = *a;
+    *a = val;
+    return retval;
+}
+#elif defined(THEORAPLAY_USE_C11_ATOMICS)
+static inline unsigned int AtomicGetUInt(THEORAPLAY_ATOMIC_UINT *a)
+{
+    return atomic_load_explicit(a, memory_order_acquire);
+}
+static inline void AtomicSetUInt(THEORAPLAY_ATOMIC_UINT *a, const unsigned int val)
+{
+    atomic_store_explicit(a, val, memory_order_release);
+}
+static inline unsigned int AtomicAddUInt(THEORAPLAY_ATOMIC_UINT *a, const unsigned int val)
+{
+    return atomic_fetch_add_explicit(a, val, memory_order_acq_rel) + val;
+}
+static inline void *AtomicGetPtr(THEORAPLAY_ATOMIC_PTR *a)
+{
+    return atomic_load_explicit(a, memory_order_acquire);
+}
+static inline void AtomicSetPtr(THEORAPLAY_ATOMIC_PTR *a, void *val)
+{
+    atomic_store_explicit(a, val, memory_order_release);
+}
+static inline void *AtomicExchangePtr(THEORAPLAY_ATOMIC_PTR *a, void *val)
+{
+    return atomic_exchange_explicit(a, val, memory_order_acq_rel);
+}
+#elif defined(__GNUC__) || defined(__clang__)
+static inline unsigned int AtomicGetUInt(THEORAPLAY_ATOMIC_UINT *a)
+{
+    return __atomic_load_n(a, __ATOMIC_ACQUIRE);
+}
+static inline void AtomicSetUInt(THEORAPLAY_ATOMIC_UINT *a, const unsigned int val)
+{
+    __atomic_store_n(a, val, __ATOMIC_RELEASE);
+}
+static inline unsigned int AtomicAddUInt(THEORAPLAY_ATOMIC_UINT *a, const unsigned int val)
+{
+    return __atomic_add_fetch(a, val, __ATOMIC_ACQ_REL);
+}
+static inline void *AtomicGetPtr(THEORAPLAY_ATOMIC_PTR *a)
+{
+    return __atomic_load_n(a, __ATOMIC_ACQUIRE);
+}
+static inline void AtomicSetPtr(THEORAPLAY_ATOMIC_PTR *a, void *val)
+{
+    __atomic_store_n(a, val, __ATOMIC_RELEASE);
+}
+static inline void *AtomicExchangePtr(THEORAPLAY_ATOMIC_PTR *a, void *val)
+{
+    return __atomic_exchange_n(a, val, __ATOMIC_ACQ_REL);
+}
+#else  // _MSC_VER
+static inline unsigned int AtomicGetUInt(THEORAPLAY_ATOMIC_UINT *a)
+{
+    const unsigned int retval = *a;
+    MemoryBarrier();
+    return retval;
+}
+static inline void AtomicSetUInt(THEORAPLAY_ATOMIC_UINT *a, const unsigned int val)
+{
+    MemoryBarrier();
+    *a = val;
+}
+static inline unsigned int AtomicAddUInt(THEORAPLAY_ATOMIC_UINT *a, const unsigned int val)
+{
+    return ((unsigned int) InterlockedExchangeAdd((volatile LONG *) a, (LONG) val)) + val;
+}
+static inline void *AtomicGetPtr(THEORAPLAY_ATOMIC_PTR *a)
+{
+    void *retval = *a;
+    MemoryBarrier();
+    return retval;
+}
+static inline void AtomicSetPtr(THEORAPLAY_ATOMIC_PTR *a, void *val)
+{
+    MemoryBarrier();
+    *a = val;
+}
+static inline void *AtomicExchangePtr(THEORAPLAY_ATOMIC_PTR *a, void *val)
+{
+    return InterlockedExchangePointer((PVOID volatile *) a, val);
+}
+#endif
 
-    buflen = io->read(io, buffer, buflen);
-    if (buflen <= 0)
-        return 0;
+#define AtomicSubUInt(a, val) AtomicAddUInt(a, 0u - (unsigned int) (val))
 
-    return (ogg_sync_wrote(sync, buflen) == 0) ? 1 : -1;
-} // FeedMoreOggData
 
+static QueueBlock *AllocateQueueBlock(ItemQueue *queue)
+{
+    const unsigned int len = sizeof (QueueBlock) + (sizeof (void *) * (queue->blockslots - 1));
+    return (QueueBlock *) queue->allocator->allocate(queue->allocator, len);
+} // AllocateQueueBlock
 
-static void QueueOggPage(TheoraDecoder *ctx)
+static void ResetQueueBlock(QueueBlock *block)
 {
-    // make sure we initialized the stream before using pagein, but the stream
-    //  will know to ignore pages that aren't meant for it, so pass to both.
-    if (ctx->tpackets)
-        ogg_stream_pagein(&ctx->tstream, &ctx->page);
-    if (ctx->vpackets)
-        ogg_stream_pagein(&ctx->vstream, &ctx->page);
-}
+    AtomicSetPtr(&block->next, NULL);
+    AtomicSetUInt(&block->tail, 0);
+    block->head = 0;
+} // ResetQueueBlock
 
-// this currently blocks, so plan ahead if pumping and not threading.
-static void PrepareDecoder(TheoraDecoder *ctx)
+static int InitItemQueue(ItemQueue *queue, const THEORAPLAY_Allocator *allocator, const unsigned int blockslots)
 {
-    while (!ctx->halt && ctx->bos)
-    {
-        if (FeedMoreOggData(ctx->io, &ctx->sync) <= 0)
-            goto cleanup;
+    memset(queue, '\0', sizeof (ItemQueue));
+    queue->allocator = allocator;
+    queue->blockslots = (blockslots > 0) ? blockslots : 1;
+    queue->readblock = queue->writeblock = AllocateQueueBlock(queue);
+    if (queue->readblock == NULL)
+        return 0;
+    ResetQueueBlock(queue->readblock);
+    return 1;
+} // InitItemQueue
 
-        // parse out the initial header.
-        while ( (!ctx->halt) && (ogg_sync_pageout(&ctx->sync, &ctx->page) > 0) )
-        {
-            ogg_stream_state test;
-            int serialno;
-
-            if (!ogg_page_bos(&ctx->page))  // not a header.
-            {
-                QueueOggPage(ctx);
-                ctx->bos = 0;
-                break;
-            } // if
+// Only call this once both ends are done with the queue, and it's empty.
+static void FreeItemQueue(ItemQueue *queue)
+{
+    QueueBlock *block = queue->readblock;
+    while (block)
+    {
+        QueueBlock *next = (QueueBlock *) AtomicGetPtr(&block->next);
+        queue->allocator->deallocate(queue->allocator, block);
+        block = next;
+    } // while
 
-            serialno = ogg_page_serialno(&ctx->page);
-            ogg_stream_init(&test, serialno);
-            ogg_stream_pagein(&test, &ctx->page);
-            ogg_stream_packetout(&test, &ctx->packet);
+    block = (QueueBlock *) AtomicExchangePtr(&queue->spare, NULL);
+    if (block)
+        queue->allocator->deallocate(queue->allocator, block);
+    queue->readblock = queue->writeblock = NULL;
+} // FreeItemQueue
 
-            if (!ctx->tpackets && (th_decode_headerin(&ctx->tinfo, &ctx->tcomment, &ctx->tsetup, &ctx->packet) >= 0))
-            {
-                memcpy(&ctx->tstream, &test, sizeof (test));
-                ctx->tpackets = 1;
-                ctx->tserialno = serialno;
-            } // if
-            else if (!ctx->vpackets && (vorbis_synthesis_headerin(&ctx->vinfo, &ctx->vcomment, &ctx->packet) >= 0))
-            {
-                memcpy(&ctx->vstream, &test, sizeof (test));
-                ctx->vpackets = 1;
-                ctx->vserialno = serialno;
-            } // else if
-            else
-            {
-                // whatever it is, we don't care about it
-                ogg_stream_clear(&test);
-            } // else
-        } // while
-    } // while
+// Producer side. Returns zero if we ran out of memory and didn't queue item.
+static int ItemQueuePush(ItemQueue *queue, void *item)
+{
+    QueueBlock *block = queue->writeblock;
+    const unsigned int tail = AtomicGetUInt(&block->tail);
 
-    // no audio OR video?
-    if (ctx->halt || (!ctx->vpackets && !ctx->tpackets))
-        goto cleanup;
+    // bump the count first, so the consumer can never see it go below zero.
+    AtomicAddUInt(&queue->count, 1);
 
-    // apparently there are two more theora and two more vorbis headers next.
-    while ((!ctx->halt) && ((ctx->tpackets && (ctx->tpackets < 3)) || (ctx->vpackets && (ctx->vpackets < 3))))
+    if (tail < queue->blockslots)
+    {
+        block->slots[tail] = item;
+        AtomicSetUInt(&block->tail, tail + 1);
+    } // if
+    else
     {
-        while (!ctx->halt && ctx->tpackets && (ctx->tpackets < 3))
+        QueueBlock *next = (QueueBlock *) AtomicExchangePtr(&queue->spare, NULL);
+        if (next == NULL)
+            next = AllocateQueueBlock(queue);
+        if (next == NULL)
         {
-            if (ogg_stream_packetout(&ctx->tstream, &ctx->packet) != 1)
-                break; // get more data?
-            if (!th_decode_headerin(&ctx->tinfo, &ctx->tcomment, &ctx->tsetup, &ctx->packet))
-                goto cleanup;
-            ctx->tpackets++;
-        } // while
+            AtomicSubUInt(&queue->count, 1);
+            return 0;
+        } // if
+        ResetQueueBlock(next);
+        next->slots[0] = item;
+        AtomicSetUInt(&next->tail, 1);
+        AtomicSetPtr(&block->next, next);  // the consumer can move on now.
+        queue->writeblock = next;
+    } // else
 
-        while (!ctx->halt && ctx->vpackets && (ctx->vpackets < 3))
-        {
-            if (ogg_stream_packetout(&ctx->vstream, &ctx->packet) != 1)
-                break;  // get more data?
-            if (vorbis_synthesis_headerin(&ctx->vinfo, &ctx->vcomment, &ctx->packet))
-                goto cleanup;
-            ctx->vpackets++;
-        } // while
+    return 1;
+} // ItemQueuePush
 
-        // get another page, try again?
-        if (ogg_sync_pageout(&ctx->sync, &ctx->page) > 0)
-            QueueOggPage(ctx);
-        else if (FeedMoreOggData(ctx->io, &ctx->sync) <= 0)
-            goto cleanup;
-    } // while
+// Consumer side. Returns NULL if the queue is empty.
+static void *ItemQueuePop(ItemQueue *queue)
+{
+    QueueBlock *block = queue->readblock;
+    void *item;
 
-    // okay, now we have our streams, ready to set up decoding.
-    if (!ctx->halt && ctx->tpackets)
+    if (block->head == queue->blockslots)
     {
-        // th_decode_alloc() docs say to check for insanely large frames yourself.
-        if ((ctx->tinfo.frame_width > 99999) || (ctx->tinfo.frame_height > 99999))
-            goto cleanup;
+        QueueBlock *next = (QueueBlock *) AtomicGetPtr(&block->next);
+        if (next == NULL)
+            return NULL;  // the producer hasn't started another block yet.
+
+        // the producer is done with this block, so give it back for reuse.
+        queue->readblock = next;
+        block = (QueueBlock *) AtomicExchangePtr(&queue->spare, block);
+        if (block)  // already had a spare? Then we don't need this one.
+            queue->allocator->deallocate(queue->allocator, block);
+        block = next;
+    } // if
 
-        // We treat "unspecified" as NTSC. *shrug*
-        if ( (ctx->tinfo.colorspace != TH_CS_UNSPECIFIED) &&
-             (ctx->tinfo.colorspace != TH_CS_ITU_REC_470M) &&
-             (ctx->tinfo.colorspace != TH_CS_ITU_REC_470BG) )
-        {
-            assert(0 && "Unsupported colorspace.");  // !!! FIXME
-            goto cleanup;
-        } // if
+    if (block->head == AtomicGetUInt(&block->tail))
+        return NULL;
 
-        if (ctx->tinfo.pixel_fmt != TH_PF_420) { assert(0); goto cleanup; } // !!! FIXME
+    item = block->slots[block->head++];
+    AtomicSubUInt(&queue->count, 1);
+    return item;
+} // ItemQueuePop
 
-        if (ctx->tinfo.fps_denominator != 0)
-            ctx->fps = ((double) ctx->tinfo.fps_numerator) / ((double) ctx->tinfo.fps_denominator);
+// Frames still in the pipeline count too; they'll land in the queue soon.
+static int VideoQueueFull(TheoraDecoder *ctx)
+{
+    return (AtomicGetUInt(&ctx->videoqueue.count) + AtomicGetUInt(&ctx->videopending)) >= ctx->maxframes;
+} // VideoQueueFull
 
-        ctx->tdec = th_decode_alloc(&ctx->tinfo, ctx->tsetup);
-        if (!ctx->tdec) goto cleanup;
 
-        // Set decoder to maximum post-processing level.
-        //  Theoretically we could try dropping this level if we're not keeping up.
-        int pp_level_max = 0;
-        // !!! FIXME: maybe an API to set this?
-        //th_decode_ctl(ctx->tdec, TH_DECCTL_GET_PPLEVEL_MAX, &pp_level_max, sizeof(pp_level_max));
-        th_decode_ctl(ctx->tdec, TH_DECCTL_SET_PPLEVEL, &pp_level_max, sizeof(pp_level_max));
-    } // if
+static void FreePooledVideoFrame(FramePool *pool, VideoFrame *item)
+{
+    pool->allocator.deallocate(&pool->allocator, item->pixels);
+    pool->allocator.deallocate(&pool->allocator, item);
+} // FreePooledVideoFrame
 
-    // Done with this now.
-    if (ctx->tsetup != NULL)
+static void UnrefFramePool(FramePool *pool)
+{
+    unsigned int refcount;
+    Mutex_Lock(pool->lock);
+    refcount = --pool->refcount;
+    Mutex_Unlock(pool->lock);
+
+    if (refcount == 0)
     {
-        th_setup_free(ctx->tsetup);
-        ctx->tsetup = NULL;
+        THEORAPLAY_Allocator allocator;
+        memcpy(&allocator, &pool->allocator, sizeof (THEORAPLAY_Allocator));
+        Mutex_Destroy(&allocator, pool->lock);
+        allocator.deallocate(&allocator, pool);
     } // if
+} // UnrefFramePool
+
+static FramePool *CreateFramePool(const THEORAPLAY_Allocator *allocator, const unsigned int capacity)
+{
+    FramePool *pool = (FramePool *) allocator->allocate(allocator, sizeof (FramePool));
+    if (pool == NULL)
+        return NULL;
 
-    if (!ctx->halt && ctx->vpackets)
+    memset(pool, '\0', sizeof (FramePool));
+    memcpy(&pool->allocator, allocator, sizeof (THEORAPLAY_Allocator));
+    pool->capacity = capacity;
+    pool->refcount = 1;
+    pool->lock = Mutex_Create(allocator);
+    if (pool->lock == NULL)
     {
-        ctx->vdsp_init = (vorbis_synthesis_init(&ctx->vdsp, &ctx->vinfo) == 0);
-        if (!ctx->vdsp_init)
-            goto cleanup;
-        ctx->vblock_init = (vorbis_block_init(&ctx->vdsp, &ctx->vblock) == 0);
-        if (!ctx->vblock_init)
-            goto cleanup;
+        allocator->deallocate(allocator, pool);
+        return NULL;
     } // if
 
-    // Now we can start the actual decoding!
-    // Note that audio and video don't _HAVE_ to start simultaneously.
+    return pool;
+} // CreateFramePool
 
-    Mutex_Lock(ctx->lock);
-    ctx->prepped = 1;
-    ctx->hasvideo = (ctx->tpackets != 0);
-    ctx->hasaudio = (ctx->vpackets != 0);
-    Mutex_Unlock(ctx->lock);
+// The decoder is done with the pool, but the app might still hold frames.
+static void DestroyFramePool(FramePool *pool)
+{
+    VideoFrame *available;
 
-cleanup:  // we will do actual cleanup when closing the decoder.
-    return;
-}
+    if (pool == NULL)
+        return;
 
-// This massive function is where all the effort happens.
-static int PumpDecoder(TheoraDecoder *ctx, int desired_frames)
+    Mutex_Lock(pool->lock);
+    available = pool->available;
+    pool->available = NULL;
+    pool->availablecount = 0;
+    pool->capacity = 0;  // anything freed from here on goes straight to the allocator.
+    Mutex_Unlock(pool->lock);
+
+    while (available)
+    {
+        VideoFrame *next = available->next;
+        FreePooledVideoFrame(pool, available);
+        available = next;
+    } // while
+
+    UnrefFramePool(pool);
+} // DestroyFramePool
+
+// Returns a frame with at least pixelslen bytes of pixels, or NULL if we're out of memory.
+static VideoFrame *GetPooledVideoFrame(FramePool *pool, const unsigned int pixelslen)
 {
-    int had_new_video_frames = 0;
+    PooledVideoFrame *pooled;
+    VideoFrame *item;
 
-    if (!ctx->prepped)
+    Mutex_Lock(pool->lock);
+    item = pool->available;
+    if (item)
     {
-        PrepareDecoder(ctx);
-        return 0;
+        pool->available = item->next;
+        pool->availablecount--;
     } // if
+    if (item && (((PooledVideoFrame *) item)->pixelslen >= pixelslen))
+        pool->hits++;
+    else
+        pool->misses++;
+    pool->refcount++;
+    Mutex_Unlock(pool->lock);
 
-    if (ctx->thread_done)
-        return 0;
-
-    while (!ctx->halt && !ctx->eos && (desired_frames > 0))
+    if (item == NULL)
     {
-        int need_pages = 0;  // need more Ogg pages?
+        item = (VideoFrame *) pool->allocator.allocate(&pool->allocator, sizeof (PooledVideoFrame));
+        if (item == NULL)
+        {
+            UnrefFramePool(pool);
+            return NULL;
+        } // if
+        memset(item, '\0', sizeof (PooledVideoFrame));
+        ((PooledVideoFrame *) item)->pool = pool;
+    } // if
 
-        if (ctx->current_seek_generation != ctx->seek_generation)  // seek requested
+    pooled = (PooledVideoFrame *) item;
+    if (pooled->pixelslen < pixelslen)
+    {
+        pool->allocator.deallocate(&pool->allocator, item->pixels);
+        item->pixels = (unsigned char *) pool->allocator.allocate(&pool->allocator, pixelslen);
+        pooled->pixelslen = item->pixels ? pixelslen : 0;
+        if (item->pixels == NULL)
         {
-            unsigned long targetms;
-            long seekpos;
-            long lo, hi;
-            int found = 0;
+            FreePooledVideoFrame(pool, item);
+            UnrefFramePool(pool);
+            return NULL;
+        } // if
+    } // if
 
-            if (!ctx->io->seek)
-                goto cleanup;  // seeking unsupported.
+    item->next = NULL;
+    return item;
+} // GetPooledVideoFrame
 
-            if (ctx->streamlen == -1)  // just check this once in case it's expensive.
-            {
-                ctx->streamlen = ctx->io->streamlen ? ctx->io->streamlen(ctx->io) : -1;
-                if (ctx->streamlen == -1)
-                    goto cleanup;  // i/o error, unsupported, etc.
-            } // if
+static void ReleasePooledVideoFrame(VideoFrame *item)
+{
+    FramePool *pool = ((PooledVideoFrame *) item)->pool;
+    int keep;
 
-            // We check ctx->seek_generation without a lock as this goes on, so if they mismatch we
-            //  drop what we're doing and prepare to seek to a new location. But here we hold a lock
-            //  so we can avoid the race condition where the app is halfway through requesting a
-            //  seek while we're reading in these variables.
-            Mutex_Lock(ctx->lock);
-            ctx->current_seek_generation = ctx->seek_generation;
-            targetms = ctx->new_seek_position_ms;
-            Mutex_Unlock(ctx->lock);
+    Mutex_Lock(pool->lock);
+    keep = (pool->availablecount < pool->capacity);
+    if (keep)
+    {
+        item->next = pool->available;
+        pool->available = item;
+        pool->availablecount++;
+    } // if
+    Mutex_Unlock(pool->lock);
 
-            lo = 0;
-            hi = ctx->streamlen;
+    if (!keep)
+        FreePooledVideoFrame(pool, item);
 
-            if (targetms < 1000)
-                hi = 0;  /* as an optimization, just jump to the start of file if seeking within the first second, instead of binary searching. */
+    UnrefFramePool(pool);
+} // ReleasePooledVideoFrame
 
-            seekpos = (lo / 2) + (hi / 2);
 
-            while ((!ctx->halt) && (ctx->current_seek_generation == ctx->seek_generation))
-            {
-                //const int max_keyframe_distance = 1 << ctx->tinfo.keyframe_granule_shift;
+static void FreeAudioPacket(AudioPacket *item)
+{
+    THEORAPLAY_Allocator allocator;  // item is going away, so don't use its copy in place.
+    memcpy(&allocator, &((AllocatedAudioPacket *) item)->allocator, sizeof (THEORAPLAY_Allocator));
+    allocator.deallocate(&allocator, item->samples);
+    allocator.deallocate(&allocator, item);
+} // FreeAudioPacket
+
+
+// Bands smaller than this aren't worth waking another thread for.
+#define MIN_CONVERT_BAND_ROWS 32
+
+// When scaling to packed pixels, this many output rows get scaled into a
+//  scratch band at a time, and converted while they're still in cache.
+#define SCALE_BAND_ROWS 16
+
+// Box-filter rows [firstrow, endrow) of a dw x dh scaled copy of a sw x sh
+//  plane into dst, which points at where firstrow goes. Each output pixel is
+//  the average of the source pixels it covers (or the nearest one, if we're
+//  scaling up). Source rows get summed into colsum first; that's a plain
+//  loop over whole rows, which compilers vectorize, so the per-pixel part is
+//  just adding up a few columns.
+static void ScalePlaneRows(const unsigned char *src, const int srcstride,
+                           const unsigned int sw, const unsigned int sh,
+                           unsigned char *dst, const int dststride,
+                           const unsigned int dw, const unsigned int dh,
+                           const unsigned int firstrow, const unsigned int endrow,
+                           unsigned int *colsum)
+{
+    unsigned int x, y;
+    for (y = firstrow; y < endrow; y++, dst += dststride)
+    {
+        const unsigned int sy0 = (unsigned int) ((((unsigned long) y) * sh) / dh);
+        unsigned int sy1 = (unsigned int) ((((unsigned long) (y + 1)) * sh) / dh);
+        const unsigned char *row = src + ((long) srcstride * (long) sy0);
+        unsigned int sy;
 
-                // Do a binary search through the stream to find our starting point.
-                // This idea came from libtheoraplayer (no relation to theoraplay).
-                if (ctx->io->seek(ctx->io, seekpos) == -1)
-                    goto cleanup;  // oh well.
+        if (sy1 <= sy0)
+            sy1 = sy0 + 1;
 
-                ctx->granulepos = -1;
-                ogg_sync_reset(&ctx->sync);
-                memset(&ctx->page, '\0', sizeof (ctx->page));
-                ogg_sync_pageseek(&ctx->sync, &ctx->page);
+        for (x = 0; x < sw; x++)
+            colsum[x] = row[x];
+        for (sy = sy0 + 1; sy < sy1; sy++)
+        {
+            row += srcstride;
+            for (x = 0; x < sw; x++)
+                colsum[x] += row[x];
+        } // for
 
-                while (!ctx->halt && (ctx->current_seek_generation == ctx->seek_generation))
-                {
-                    if (ogg_sync_pageout(&ctx->sync, &ctx->page) != 1)
-                    {
-                        if (FeedMoreOggData(ctx->io, &ctx->sync) <= 0)
-                            goto cleanup;
-                        continue;
-                    } // if
+        for (x = 0; x < dw; x++)
+        {
+            const unsigned int sx0 = (unsigned int) ((((unsigned long) x) * sw) / dw);
+            unsigned int sx1 = (unsigned int) ((((unsigned long) (x + 1)) * sw) / dw);
+            unsigned long total = 0;
+            unsigned long count;
+            unsigned int sx;
+
+            if (sx1 <= sx0)
+                sx1 = sx0 + 1;
+            for (sx = sx0; sx < sx1; sx++)
+                total += colsum[sx];
+
+            count = ((unsigned long) (sx1 - sx0)) * ((unsigned long) (sy1 - sy0));
+            dst[x] = (unsigned char) ((total + (count / 2)) / count);
+        } // for
+    } // for
+} // ScalePlaneRows
+
+static unsigned int ScaleScratchSize(const TheoraDecoder *ctx)
+{
+    const unsigned int w = ctx->outwidth;
+    const unsigned int colsumlen = sizeof (unsigned int) * ctx->tinfo.pic_width;
+    return colsumlen + (w * SCALE_BAND_ROWS) + ((w / 2) * (SCALE_BAND_ROWS / 2) * 2);
+} // ScaleScratchSize
 
-                    ctx->granulepos = ogg_page_granulepos(&ctx->page);
-                    if (ctx->granulepos >= 0)
-                    {
-                        const int serialno = ogg_page_serialno(&ctx->page);
-                        unsigned long ms;
+static unsigned int PackedPixelBytes(const THEORAPLAY_VideoFormat vidfmt)
+{
+    switch (vidfmt)
+    {
+        case THEORAPLAY_VIDFMT_RGB: return 3;
+        case THEORAPLAY_VIDFMT_RGBA:
+        case THEORAPLAY_VIDFMT_BGRA: return 4;
+        case THEORAPLAY_VIDFMT_RGB565: return 2;
+        default: break;  // planar.
+    } // switch
+    return 0;
+} // PackedPixelBytes
+
+// Convert output rows [firstrow, endrow) of a frame. If we're scaling, the
+//  planar formats get scaled straight into the frame, and everything else
+//  goes a band at a time through scratch (from ScaleScratchSize()), so we
+//  never have a full-size copy of the picture in the output format.
+static void ConvertRows(TheoraDecoder *ctx, const th_ycbcr_buffer ycbcr, unsigned char *pixels,
+                        const int firstrow, const int endrow, unsigned char *scratch)
+{
+    const unsigned int w = ctx->outwidth;
+    const unsigned int h = ctx->outheight;
+    const unsigned int bpp = PackedPixelBytes(ctx->vidfmt);
+    unsigned int *colsum = (unsigned int *) scratch;
+    const unsigned char *src[3];
+    unsigned int sw[3], sh[3];
+    int i;
 
-                        if (ctx->tpackets)  // always tee off video frames if possible.
-                        {
-                            if (serialno != ctx->tserialno)
-                                continue;
-                            ms = (unsigned long) (th_granule_time(ctx->tdec, ctx->granulepos) * 1000.0);
-                        } // else
-                        else
-                        {
-                            if (serialno != ctx->vserialno)
-                                continue;
-                            ms = (unsigned long) (vorbis_granule_time(&ctx->vdsp, ctx->granulepos) * 1000.0);
-                        } // else
+    if (!ctx->scaling)
+    {
+        ctx->vidcvt(&ctx->tinfo, ycbcr, pixels, firstrow, endrow);
+        return;
+    } // if
 
-                        if ((ms < targetms) && ((targetms - ms) >= 500) && ((targetms - ms) <= 1000))   // !!! FIXME: tweak this number?
-                            found = 1;  // found something close enough to the target!
-                        else  // adjust binary search position and try again.
-                        {
-                            const long newpos = (lo / 2) + (hi / 2);
-                            if (targetms > ms)
-                                lo = newpos;
-                            else
-                                hi = newpos;
-                        } // else
-                        break;
-                    } // if
-                } // while
+    for (i = 0; i < 3; i++)
+    {
+        const unsigned char *low;
+        unsigned int len;
+        GetPlaneLayout(&ctx->tinfo, ycbcr, i, &low, &src[i], &len, &sw[i], &sh[i]);
+        src[i] += i ? (ctx->tinfo.pic_x / 2) : ctx->tinfo.pic_x;
+    } // for
 
-                if (found)
-                    break;
+    if (bpp == 0)  // planar: there's nothing to convert, so scale right into the frame.
+    {
+        const int cbfirst = (ctx->vidfmt != THEORAPLAY_VIDFMT_YV12);  // YV12 stores Cr first.
+        unsigned char *cb = pixels + (w * h) + (cbfirst ? 0 : ((w / 2) * (h / 2)));
+        unsigned char *cr = pixels + (w * h) + (cbfirst ? ((w / 2) * (h / 2)) : 0);
+        ScalePlaneRows(src[0], ycbcr[0].stride, sw[0], sh[0], pixels + (w * firstrow), (int) w, w, h, firstrow, endrow, colsum);
+        ScalePlaneRows(src[1], ycbcr[1].stride, sw[1], sh[1], cb + ((w / 2) * (firstrow / 2)), (int) (w / 2), w / 2, h / 2, firstrow / 2, endrow / 2, colsum);
+        ScalePlaneRows(src[2], ycbcr[2].stride, sw[2], sh[2], cr + ((w / 2) * (firstrow / 2)), (int) (w / 2), w / 2, h / 2, firstrow / 2, endrow / 2, colsum);
+    } // if
+    else
+    {
+        unsigned char *band = scratch + (sizeof (unsigned int) * ctx->tinfo.pic_width);
+        th_ycbcr_buffer scaled;
+        th_info bandinfo;
+        int row;
+
+        memcpy(&bandinfo, &ctx->outinfo, sizeof (th_info));
+        scaled[0].data = band;
+        scaled[0].stride = scaled[0].width = (int) w;
+        scaled[1].data = band + (w * SCALE_BAND_ROWS);
+        scaled[2].data = scaled[1].data + ((w / 2) * (SCALE_BAND_ROWS / 2));
+        scaled[1].stride = scaled[1].width = scaled[2].stride = scaled[2].width = (int) (w / 2);
+
+        // firstrow and SCALE_BAND_ROWS are even, so every band is too.
+        for (row = firstrow; row < endrow; row += SCALE_BAND_ROWS)
+        {
+            const int rows = ((endrow - row) < SCALE_BAND_ROWS) ? (endrow - row) : SCALE_BAND_ROWS;
+            scaled[0].height = rows;
+            scaled[1].height = scaled[2].height = rows / 2;
+            bandinfo.pic_height = bandinfo.frame_height = (unsigned int) rows;
+            ScalePlaneRows(src[0], ycbcr[0].stride, sw[0], sh[0], scaled[0].data, scaled[0].stride, w, h, row, row + rows, colsum);
+            ScalePlaneRows(src[1], ycbcr[1].stride, sw[1], sh[1], scaled[1].data, scaled[1].stride, w / 2, h / 2, row / 2, (row + rows) / 2, colsum);
+            ScalePlaneRows(src[2], ycbcr[2].stride, sw[2], sh[2], scaled[2].data, scaled[2].stride, w / 2, h / 2, row / 2, (row + rows) / 2, colsum);
+            ctx->vidcvt(&bandinfo, scaled, pixels + (w * bpp * row), 0, rows);
+        } // for
+    } // else
+} // ConvertRows
 
-                const long newseekpos = (lo / 2) + (hi / 2);
-                if (seekpos == newseekpos)
-                    break;  // we did the best we could, just go from here.
-                seekpos = newseekpos;
-            } // while
+static void *ConvertHelperThread(void *_this)
+{
+    ConvertHelper *helper = (ConvertHelper *) _this;
+    TheoraDecoder *ctx = helper->ctx;
+    while (1)
+    {
+        Semaphore_Wait(helper->go);
+        if (ctx->cvthalt)
+            break;
+        ConvertRows(ctx, ctx->cvtycbcr, ctx->cvtpixels, helper->firstrow, helper->endrow, helper->scalescratch);
+        Semaphore_Post(ctx->cvtdone);
+    } // while
+    return NULL;
+} // ConvertHelperThread
 
-            // at this point, we have seek'd to something reasonably close to our target. Now decode until we're as close as possible to it.
-            vorbis_synthesis_restart(&ctx->vdsp);
-            ctx->resolving_audio_seek = ctx->vpackets;
-            ctx->resolving_video_seek = ctx->tpackets;
-            ctx->seek_target = targetms;
-            ctx->need_keyframe = ctx->tpackets;
-        } // if
+static void StopConvertHelpers(TheoraDecoder *ctx)
+{
+    unsigned int i;
 
-        // Try to read as much audio as we can at once. We limit the outer
-        //  loop to one video frame and as much audio as we can eat.
-        while (!ctx->halt && ctx->vpackets)
+    if (!ctx->cvthelpers)
+        return;
+
+    ctx->cvthalt = 1;
+    for (i = 0; i < ctx->cvthelpercount; i++)
+    {
+        ConvertHelper *helper = &ctx->cvthelpers[i];
+        if (helper->thread_created)
         {
-            const double audiotime = vorbis_granule_time(&ctx->vdsp, ctx->vdsp.granulepos);
-            const unsigned int playms = (unsigned int) (audiotime * 1000.0);
-            float **pcm = NULL;
-            int frames;
+            Semaphore_Post(helper->go);
+            Thread_Join(helper->thread);
+        } // if
+        Semaphore_Destroy(&ctx->allocator, helper->go);
+        if (helper->scalescratch)
+            ctx->allocator.deallocate(&ctx->allocator, helper->scalescratch);
+    } // for
+
+    Semaphore_Destroy(&ctx->allocator, ctx->cvtdone);
+    ctx->allocator.deallocate(&ctx->allocator, ctx->cvthelpers);
+    ctx->cvthelpers = NULL;
+    ctx->cvthelpercount = 0;
+    ctx->cvtdone = NULL;
+} // StopConvertHelpers
+
+// If this fails, we just carry on converting on the decoding thread.
+static void StartConvertHelpers(TheoraDecoder *ctx, const unsigned int count)
+{
+    unsigned int i;
 
-            if (ctx->current_seek_generation != ctx->seek_generation)
-                break;  // seek requested? Break out of the loop right away so we can handle it; this loop's work would be wasted.
+    if (THEORAPLAY_ONLY_SINGLE_THREADED || (count == 0))
+        return;
 
-            if (ctx->resolving_audio_seek)
-            {
-                if (ctx->seek_target < 1000)   // if the seek target is the start of the data, assume we're good even before audiotime is valid. As soon as we have data, ship it.
-                    ctx->resolving_audio_seek = 0;
-                else if ((audiotime >= 0.0) && ((playms >= ctx->seek_target) || ((ctx->seek_target - playms) <= (unsigned long) (1000.0 / ctx->fps))))
-                    ctx->resolving_audio_seek = 0;
-            }
+    ctx->cvthelpers = (ConvertHelper *) ctx->allocator.allocate(&ctx->allocator, sizeof (ConvertHelper) * count);
+    if (ctx->cvthelpers == NULL)
+        return;
 
-            frames = vorbis_synthesis_pcmout(&ctx->vdsp, &pcm);
-            if (frames > 0)
-            {
-                if (!ctx->resolving_audio_seek)
-                {
-                    const int channels = ctx->vinfo.channels;
-                    int chanidx, frameidx;
-                    float *samples;
-                    AudioPacket *item = (AudioPacket *) ctx->allocator.allocate(&ctx->allocator, sizeof (AudioPacket));
-                    if (item == NULL) goto cleanup;
-                    item->seek_generation = ctx->current_seek_generation;
-                    item->playms = playms;
+    memset(ctx->cvthelpers, '\0', sizeof (ConvertHelper) * count);
+    ctx->cvthelpercount = count;
+    ctx->cvthalt = 0;
+    ctx->cvtdone = Semaphore_Create(&ctx->allocator);
+    if (ctx->cvtdone == NULL)
+    {
+        StopConvertHelpers(ctx);
+        return;
+    } // if
+
+    for (i = 0; i < count; i++)
+    {
+        ConvertHelper *helper = &ctx->cvthelpers[i];
+        helper->ctx = ctx;
+        helper->go = Semaphore_Create(&ctx->allocator);
+        if (helper->go == NULL)
+            break;
+        helper->thread_created = (Thread_Create(&helper->thread, ConvertHelperThread, helper) == 0);
+        if (!helper->thread_created)
+            break;
+    } // for
+
+    if (i < count)
+        StopConvertHelpers(ctx);
+} // StartConvertHelpers
+
+// Convert the whole picture, split into bands across the helper threads if we have any.
+static void ConvertVideoFrame(TheoraDecoder *ctx, const th_ycbcr_buffer ycbcr, unsigned char *pixels)
+{
+    const int h = (int) ctx->outheight;
+    int bands = (int) ctx->cvthelpercount + 1;  // the calling thread takes the first band.
+    int rowsperband, row, i;
+
+    if (bands > (h / MIN_CONVERT_BAND_ROWS))
+        bands = h / MIN_CONVERT_BAND_ROWS;
+
+    if (bands <= 1)
+    {
+        ConvertRows(ctx, ycbcr, pixels, 0, h, ctx->scalescratch);
+        return;
+    } // if
+
+    rowsperband = (((h + bands - 1) / bands) + 1) & ~1;  // keep bands on pairs of rows, for 4:2:0.
+    ctx->cvtycbcr = ycbcr;
+    ctx->cvtpixels = pixels;
+
+    row = rowsperband;
+    for (i = 0; (i < (bands - 1)) && (row < h); i++)
+    {
+        ConvertHelper *helper = &ctx->cvthelpers[i];
+        helper->firstrow = row;
+        helper->endrow = ((row + rowsperband) < h) ? (row + rowsperband) : h;
+        row = helper->endrow;
+        Semaphore_Post(helper->go);
+    } // for
+
+    ConvertRows(ctx, ycbcr, pixels, 0, rowsperband, ctx->scalescratch);
+
+    while (i--)
+        Semaphore_Wait(ctx->cvtdone);
+} // ConvertVideoFrame
+
+
+// Returns zero if we ran out of memory, in which case item was freed.
+static int QueueVideoFrame(TheoraDecoder *ctx, VideoFrame *item)
+{
+    //printf("Decoded another video frame.\n");
+    if (!ItemQueuePush(&ctx->videoqueue, item))
+    {
+        ReleasePooledVideoFrame(item);
+        return 0;
+    } // if
+    return 1;
+} // QueueVideoFrame
+
+static void *PipelineThread(void *_this)
+{
+    TheoraDecoder *ctx = (TheoraDecoder *) _this;
+    while (1)
+    {
+        PipelineSlot *slot;
+
+        Semaphore_Wait(ctx->pipefull);
+        if (ctx->pipehalt)
+            break;
+
+        slot = &ctx->pipeslots[ctx->pipereadidx];
+        ctx->pipereadidx = (ctx->pipereadidx + 1) % PIPELINE_SLOTS;
+
+        ConvertVideoFrame(ctx, slot->ycbcr, slot->item->pixels);
+        QueueVideoFrame(ctx, slot->item);  // if this fails, we just drop the frame.
+        AtomicSubUInt(&ctx->videopending, 1);  // after queueing, so the worker never undercounts.
+        slot->item = NULL;
+
+        Semaphore_Post(ctx->pipefree);
+    } // while
+    return NULL;
+} // PipelineThread
+
+// Hands a frame to the conversion stage. Blocks if the stage is still busy
+//  with older frames. Returns zero on allocation failure.
+static int PipelineSubmit(TheoraDecoder *ctx, VideoFrame *item, const th_ycbcr_buffer ycbcr)
+{
+    PipelineSlot *slot;
+    unsigned int needed = 0;
+    unsigned char *dst;
+    int i, row;
+
+    for (i = 0; i < 3; i++)
+        needed += (unsigned int) (ycbcr[i].width * ycbcr[i].height);
+
+    Semaphore_Wait(ctx->pipefree);
+    slot = &ctx->pipeslots[ctx->pipewriteidx];
+
+    if (slot->planeslen < needed)
+    {
+        ctx->allocator.deallocate(&ctx->allocator, slot->planes);
+        slot->planes = (unsigned char *) ctx->allocator.allocate(&ctx->allocator, needed);
+        slot->planeslen = slot->planes ? needed : 0;
+        if (slot->planes == NULL)
+        {
+            Semaphore_Post(ctx->pipefree);
+            return 0;
+        } // if
+    } // if
+
+    // strides can be negative, so copy a row at a time.
+    dst = slot->planes;
+    for (i = 0; i < 3; i++)
+    {
+        slot->ycbcr[i].width = ycbcr[i].width;
+        slot->ycbcr[i].height = ycbcr[i].height;
+        slot->ycbcr[i].stride = ycbcr[i].width;
+        slot->ycbcr[i].data = dst;
+        for (row = 0; row < ycbcr[i].height; row++, dst += ycbcr[i].width)
+            memcpy(dst, ycbcr[i].data + (ycbcr[i].stride * row), ycbcr[i].width);
+    } // for
+
+    slot->item = item;
+    ctx->pipewriteidx = (ctx->pipewriteidx + 1) % PIPELINE_SLOTS;
+    AtomicAddUInt(&ctx->videopending, 1);
+
+    Semaphore_Post(ctx->pipefull);
+    return 1;
+} // PipelineSubmit
+
+// Wait for everything in the pipeline to land in videoqueue.
+static void PipelineDrain(TheoraDecoder *ctx)
+{
+    int i;
+    if (!ctx->pipeline_created)
+        return;
+    for (i = 0; i < PIPELINE_SLOTS; i++)
+        Semaphore_Wait(ctx->pipefree);
+    for (i = 0; i < PIPELINE_SLOTS; i++)
+        Semaphore_Post(ctx->pipefree);
+} // PipelineDrain
+
+static void StopPipeline(TheoraDecoder *ctx)
+{
+    int i;
+
+    if (ctx->pipeline_created)
+    {
+        PipelineDrain(ctx);
+        ctx->pipehalt = 1;
+        Semaphore_Post(ctx->pipefull);
+        Thread_Join(ctx->pipeline);
+        ctx->pipeline_created = 0;
+    } // if
+
+    for (i = 0; i < PIPELINE_SLOTS; i++)
+    {
+        ctx->allocator.deallocate(&ctx->allocator, ctx->pipeslots[i].planes);
+        ctx->pipeslots[i].planes = NULL;
+        ctx->pipeslots[i].planeslen = 0;
+    } // for
+
+    Semaphore_Destroy(&ctx->allocator, ctx->pipefree);
+    Semaphore_Destroy(&ctx->allocator, ctx->pipefull);
+    ctx->pipefree = ctx->pipefull = NULL;
+} // StopPipeline
+
+// If this fails, we just carry on converting on the decoding thread.
+static void StartPipeline(TheoraDecoder *ctx)
+{
+    int i;
+
+    if (THEORAPLAY_ONLY_SINGLE_THREADED)
+        return;
+
+    ctx->pipehalt = 0;
+    ctx->pipefree = Semaphore_Create(&ctx->allocator);
+    ctx->pipefull = Semaphore_Create(&ctx->allocator);
+    if (!ctx->pipefree || !ctx->pipefull)
+    {
+        StopPipeline(ctx);
+        return;
+    } // if
+
+    for (i = 0; i < PIPELINE_SLOTS; i++)
+        Semaphore_Post(ctx->pipefree);
+
+    ctx->pipeline_created = (Thread_Create(&ctx->pipeline, PipelineThread, ctx) == 0);
+    if (!ctx->pipeline_created)
+        StopPipeline(ctx);
+} // StartPipeline
+
+
+static int FeedMoreOggData(THEORAPLAY_Io64 *io, ogg_sync_state *sync, long buflen)
+{
+    char *buffer = ogg_sync_buffer(sync, buflen);
+    if (buffer == NULL)
+        return -1;
+
+    buflen = io->read(io, buffer, buflen);
+    if (buflen <= 0)
+        return 0;
+
+    return (ogg_sync_wrote(sync, buflen) == 0) ? 1 : -1;
+} // FeedMoreOggData
+
+
+// Ogg's CRC-32 (polynomial 0x04c11db7, unreflected, starting at zero), a
+//  nibble at a time, over a page with its checksum field counted as zero.
+static int OggPageChecksumOk(const unsigned char *page, const long len)
+{
+    static const ogg_uint32_t table[16] = {
+        0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b, 0x1a864db2, 0x1e475005,
+        0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61, 0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd
+    };
+    const ogg_uint32_t want = ((ogg_uint32_t) page[22]) | (((ogg_uint32_t) page[23]) << 8) |
+                              (((ogg_uint32_t) page[24]) << 16) | (((ogg_uint32_t) page[25]) << 24);
+    ogg_uint32_t crc = 0;
+    long i;
+
+    for (i = 0; i < len; i++)
+    {
+        const unsigned int byte = ((i >= 22) && (i < 26)) ? 0 : page[i];
+        crc = (crc << 4) ^ table[((crc >> 28) ^ (byte >> 4)) & 0xF];
+        crc = (crc << 4) ^ table[((crc >> 28) ^ byte) & 0xF];
+    } // for
+
+    return (crc == want);
+} // OggPageChecksumOk
+
+// ogg_sync_pageseek() for a memory mapping: the page we hand back points
+//  right into the mapping, so nothing gets copied on the way to libogg.
+static int NextMappedOggPage(TheoraDecoder *ctx)
+{
+    while (ctx->syncpos < ctx->mapend)
+    {
+        const unsigned char *ptr = ctx->mapdata + ctx->syncpos;
+        const ogg_int64_t avail = ctx->mapend - ctx->syncpos;
+        long headerlen, bodylen;
+        int i;
+
+        if (avail < 27)
+            return 0;  // need more data.
+        else if ((memcmp(ptr, "OggS", 4) != 0) || (ptr[4] != 0))
+        {
+            // skip junk up to the next possible capture pattern.
+            const unsigned char *next = (const unsigned char *) memchr(ptr + 1, 'O', (size_t) (avail - 1));
+            ctx->syncpos = next ? (ogg_int64_t) (next - ctx->mapdata) : ctx->mapend;
+            continue;
+        } // else if
+
+        headerlen = 27 + ptr[26];
+        if (avail < headerlen)
+            return 0;
+
+        bodylen = 0;
+        for (i = 0; i < ptr[26]; i++)
+            bodylen += ptr[27 + i];
+        if (avail < (headerlen + bodylen))
+            return 0;
+
+        if (!OggPageChecksumOk(ptr, headerlen + bodylen))
+        {
+            ctx->syncpos++;  // corrupt, or a false capture pattern; keep looking.
+            continue;
+        } // if
+
+        ctx->page.header = (unsigned char *) ptr;  // libogg only reads these.
+        ctx->page.header_len = headerlen;
+        ctx->page.body = (unsigned char *) (ptr + headerlen);
+        ctx->page.body_len = bodylen;
+        ctx->pageoffset = ctx->syncpos;
+        ctx->syncpos += headerlen + bodylen;
+        return 1;
+    } // while
+
+    return 0;
+} // NextMappedOggPage
+
+// FeedMoreOggData() for the decoder's own stream. A mapping has nothing to
+//  copy; we just let NextOggPage() look further along it. Pass non-zero for
+//  probing if this is a seek looking for the next page and nothing more.
+static int FeedDecoder(TheoraDecoder *ctx, const int probing)
+{
+    const long chunk = (probing && ctx->adaptiveread) ? READ_CHUNK_PROBE : ctx->readchunk;
+
+    if (ctx->mapdata == NULL)
+        return FeedMoreOggData(ctx->io, &ctx->sync, chunk);
+    else if (ctx->mapend >= ctx->maplen)
+        return 0;  // end of stream.
+
+    ctx->mapend = ((ctx->maplen - ctx->mapend) > chunk) ? (ctx->mapend + chunk) : ctx->maplen;
+    return 1;
+} // FeedDecoder
+
+// Tell the adaptive read size how far into the stream's playback time we've
+//  decoded. Compares that to how many bytes it took to get there since the
+//  last seek, and sizes readchunk to match.
+static void UpdateReadChunk(TheoraDecoder *ctx, const unsigned long ms)
+{
+    if (!ctx->adaptiveread)
+        return;  // the app picked a fixed size.
+    else if (ctx->ratepos == -1)
+    {
+        ctx->ratepos = ctx->syncpos;
+        ctx->ratems = ms;
+    } // else if
+    else if ((ms >= (ctx->ratems + 1000)) && (ctx->syncpos > ctx->ratepos))
+    {
+        const double bytesperms = ((double) (ctx->syncpos - ctx->ratepos)) / ((double) (ms - ctx->ratems));
+        const double want = bytesperms * READ_CHUNK_MEDIA_MS;
+        long chunk = READ_CHUNK_DEFAULT;
+        while ((chunk < READ_CHUNK_MAX) && (((double) chunk) < want))
+            chunk *= 2;
+        ctx->readchunk = chunk;
+    } // else if
+} // UpdateReadChunk
+
+// The kernel reads ahead through a mapping we're playing through, but that's
+//  wasted I/O while a seek is hopping around the file looking for its target.
+static void AdviseMapping(TheoraDecoder *ctx, const int seeking)
+{
+    #ifdef THEORAPLAY_HAVE_MMAP
+    if (ctx->mmapped)
+        madvise((void *) ctx->mapdata, (size_t) ctx->maplen, seeking ? MADV_RANDOM : MADV_SEQUENTIAL);
+    #endif
+} // AdviseMapping
+
+// ogg_sync_pageout(), but it keeps track of where in the stream each page
+//  came from, for the seek index.
+static int NextOggPage(TheoraDecoder *ctx)
+{
+    if (ctx->mapdata)
+        return NextMappedOggPage(ctx);
+
+    while (1)
+    {
+        const long rc = ogg_sync_pageseek(&ctx->sync, &ctx->page);
+        if (rc == 0)
+            return 0;  // need more data.
+        else if (rc < 0)
+            ctx->syncpos += -rc;  // skipped some junk.
+        else
+        {
+            ctx->pageoffset = ctx->syncpos;
+            ctx->syncpos += rc;
+            return 1;
+        } // else
+    } // while
+} // NextOggPage
+
+// Call this after the Io seeks, so we start parsing pages fresh from offset.
+static void ResetOggSync(TheoraDecoder *ctx, const ogg_int64_t offset)
+{
+    ctx->granulepos = -1;
+    ogg_sync_reset(&ctx->sync);
+    memset(&ctx->page, '\0', sizeof (ctx->page));
+    ctx->syncpos = offset;
+    ctx->mapend = offset;
+    ctx->ratepos = -1;  // we jumped; start measuring the bitrate again.
+} // ResetOggSync
+
+// Frame number (or sample, for audio-only streams) a granulepos ends on.
+static ogg_int64_t SeekIndexFrame(TheoraDecoder *ctx, const ogg_int64_t granulepos)
+{
+    return ctx->tpackets ? th_granule_frame(ctx->tdec, granulepos) : granulepos;
+} // SeekIndexFrame
+
+// Frame number of the keyframe that a granulepos depends on. Every Vorbis
+//  packet stands on its own, more or less.
+static ogg_int64_t SeekIndexKeyframe(TheoraDecoder *ctx, const ogg_int64_t granulepos)
+{
+    const int shift = ctx->tinfo.keyframe_granule_shift;
+    return ctx->tpackets ? th_granule_frame(ctx->tdec, (granulepos >> shift) << shift) : granulepos;
+} // SeekIndexKeyframe
+
+static void FreeSeekIndex(const THEORAPLAY_Allocator *allocator, SeekIndex *index)
+{
+    if (index->entries)
+        allocator->deallocate(allocator, index->entries);
+    memset(index, '\0', sizeof (*index));
+} // FreeSeekIndex
+
+// Make room for one more entry. Returns zero if we're out of memory.
+static int GrowSeekIndex(const THEORAPLAY_Allocator *allocator, SeekIndex *index)
+{
+    const unsigned int newcap = index->cap ? (index->cap * 2) : 256;
+    SeekIndexEntry *entries;
+
+    if (index->len < index->cap)
+        return 1;
+
+    entries = (SeekIndexEntry *) allocator->allocate(allocator, sizeof (SeekIndexEntry) * newcap);
+    if (entries == NULL)
+        return 0;
+    if (index->entries)
+    {
+        memcpy(entries, index->entries, sizeof (SeekIndexEntry) * index->len);
+        allocator->deallocate(allocator, index->entries);
+    } // if
+    index->entries = entries;
+    index->cap = newcap;
+    return 1;
+} // GrowSeekIndex
+
+// prevoffset is the seek index page we read right before this one, or
+//  SEEKINDEX_GAP or SEEKINDEX_TOP.
+static void InsertSeekIndex(const THEORAPLAY_Allocator *allocator, SeekIndex *index,
+                            const ogg_int64_t offset, const ogg_int64_t granulepos,
+                            const ogg_int64_t prevoffset)
+{
+    SeekIndexEntry *entry;
+    unsigned int lo = 0;
+    unsigned int hi = index->len;
+    int joined;
+
+    // most pages go on the end, so check there before searching.
+    if ((hi > 0) && (index->entries[hi - 1].offset < offset))
+        lo = hi;
+
+    while (lo < hi)
+    {
+        const unsigned int mid = lo + ((hi - lo) / 2);
+        if (index->entries[mid].offset < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    } // while
+
+    if (lo == 0)
+        joined = (prevoffset == SEEKINDEX_TOP);
+    else
+        joined = (prevoffset >= 0) && (index->entries[lo - 1].offset == prevoffset);
+
+    if ((lo < index->len) && (index->entries[lo].offset == offset))
+    {
+        if (joined)
+            index->entries[lo].joined = 1;  // seen this one before, but maybe not how we got here.
+        return;
+    } // if
+    else if (!GrowSeekIndex(allocator, index))
+        return;  // oh well, we'll bisect for this part.
+
+    entry = &index->entries[lo];
+    if (lo < index->len)
+    {
+        memmove(entry + 1, entry, sizeof (SeekIndexEntry) * (index->len - lo));
+        entry[1].joined = 0;  // whatever it was joined to, it isn't anymore.
+    } // if
+    entry->offset = offset;
+    entry->granulepos = granulepos;
+    entry->joined = joined;
+    index->len++;
+} // InsertSeekIndex
+
+// Is index->entries[i] still joined once it lands after merged[len-1]?
+static int SeekIndexStillJoined(const SeekIndex *index, const unsigned int i,
+                                const SeekIndexEntry *merged, const unsigned int len)
+{
+    if (!index->entries[i].joined)
+        return 0;
+    else if (i == 0)
+        return (len == 0);
+    return (len > 0) && (merged[len - 1].offset == index->entries[i - 1].offset);
+} // SeekIndexStillJoined
+
+// Fold src into dst in one pass. src is left alone. Returns zero if we're
+//  out of memory, in which case dst is left alone too.
+static int MergeSeekIndex(const THEORAPLAY_Allocator *allocator, SeekIndex *dst, const SeekIndex *src)
+{
+    const unsigned int cap = dst->len + src->len;
+    SeekIndexEntry *entries;
+    unsigned int i = 0, j = 0, len = 0;
+
+    if (src->len == 0)
+        return 1;
+
+    entries = (SeekIndexEntry *) allocator->allocate(allocator, sizeof (SeekIndexEntry) * cap);
+    if (entries == NULL)
+        return 0;
+
+    while ((i < dst->len) || (j < src->len))
+    {
+        int joined;
+        if ((j == src->len) || ((i < dst->len) && (dst->entries[i].offset <= src->entries[j].offset)))
+        {
+            joined = SeekIndexStillJoined(dst, i, entries, len);
+            if ((j < src->len) && (dst->entries[i].offset == src->entries[j].offset))
+            {
+                // we both have this one; either of us might know how it joins up.
+                joined = joined || SeekIndexStillJoined(src, j, entries, len);
+                j++;
+            } // if
+            entries[len] = dst->entries[i++];
+        } // if
+        else
+        {
+            joined = SeekIndexStillJoined(src, j, entries, len);
+            entries[len] = src->entries[j++];
+        } // else
+        entries[len++].joined = joined;
+    } // while
+
+    FreeSeekIndex(allocator, dst);
+    dst->entries = entries;
+    dst->len = len;
+    dst->cap = cap;
+    return 1;
+} // MergeSeekIndex
+
+// Only pages from the stream we seek by, with a packet finishing on them.
+static int IsSeekIndexPage(TheoraDecoder *ctx, const ogg_page *page)
+{
+    const int serialno = ctx->tpackets ? ctx->tserialno : ctx->vserialno;
+    if (!ctx->tpackets && !ctx->vpackets)
+        return 0;
+    else if (ogg_page_serialno(page) != serialno)
+        return 0;
+    return (ogg_page_granulepos(page) >= 0);
+} // IsSeekIndexPage
+
+// Note where ctx->page is, if it's from the stream we seek by. Every page we
+//  read has to come through here, so we can tell when we've skipped some.
+static void IndexOggPage(TheoraDecoder *ctx)
+{
+    if (ctx->pageoffset != ctx->indexedto)
+        ctx->indexprev = SEEKINDEX_GAP;  // seeked, or dropped junk; could have missed anything.
+    ctx->indexedto = ctx->syncpos;
+
+    if (ctx->tpackets ? (ctx->tdec == NULL) : !ctx->vdsp_init)
+        return;  // still parsing headers.
+    else if (!IsSeekIndexPage(ctx, &ctx->page))
+        return;
+
+    Mutex_Lock(ctx->indexlock);
+    InsertSeekIndex(&ctx->allocator, &ctx->seekindex, ctx->pageoffset, ogg_page_granulepos(&ctx->page), ctx->indexprev);
+    Mutex_Unlock(ctx->indexlock);
+    ctx->indexprev = ctx->pageoffset;
+} // IndexOggPage
+
+// Returns the stream offset to start decoding from, to reach target (a frame
+//  number, or a sample for audio-only streams) by way of its keyframe, or -1
+//  if we haven't indexed that part of the stream yet. The index has holes
+//  wherever we seeked past something, and a page on the far side of one
+//  tells us nothing about what's in it, so every page from where we start
+//  to the target's has to be joined to the one before it.
+static ogg_int64_t SeekIndexLookup(TheoraDecoder *ctx, const ogg_int64_t target)
+{
+    const SeekIndexEntry *entries = ctx->seekindex.entries;
+    unsigned int lo = 0;
+    unsigned int hi = ctx->seekindex.len;
+    unsigned int last;
+    ogg_int64_t keyframe;
+
+    // find the first page that finishes at or past the target.
+    while (lo < hi)
+    {
+        const unsigned int mid = lo + ((hi - lo) / 2);
+        if (SeekIndexFrame(ctx, entries[mid].granulepos) < target)
+            lo = mid + 1;
+        else
+            hi = mid;
+    } // while
+
+    if (lo == ctx->seekindex.len)
+        return -1;  // haven't been that far yet.
+
+    // if that page's keyframe is past the target, the previous page's
+    //  keyframe is the one we want.
+    last = lo;
+    keyframe = SeekIndexKeyframe(ctx, entries[lo].granulepos);
+    if (keyframe > target)
+    {
+        if (!entries[lo].joined)
+            return -1;  // the previous page is somewhere we haven't been.
+        else if (lo == 0)
+            return 0;  // target is before the first page; just start from the top.
+        keyframe = SeekIndexKeyframe(ctx, entries[lo - 1].granulepos);
+    } // if
+
+    // start on the last page that finishes before the keyframe does, so we
+    //  get all of the keyframe's packet.
+    hi = lo;
+    lo = 0;
+    while (lo < hi)
+    {
+        const unsigned int mid = lo + ((hi - lo) / 2);
+        if (SeekIndexFrame(ctx, entries[mid].granulepos) < keyframe)
+            lo = mid + 1;
+        else
+            hi = mid;
+    } // while
+
+    // make sure we've seen everything between there and the target.
+    for (hi = lo; hi <= last; hi++)
+    {
+        if (!entries[hi].joined)
+            return -1;
+    } // for
+
+    return (lo > 0) ? entries[lo - 1].offset : 0;
+} // SeekIndexLookup
+
+// Walks every page in the stream on its own Io, without decoding anything,
+//  and folds what it finds into the decoder's index when it's done. Runs
+//  at low priority, so it only gets the CPU the decoder isn't using.
+static void *IndexScanThread(void *_ctx)
+{
+    TheoraDecoder *ctx = (TheoraDecoder *) _ctx;
+    THEORAPLAY_Io64 *io = ctx->scanio;
+    SeekIndex found;
+    ogg_sync_state sync;
+    ogg_page page;
+    ogg_int64_t offset = 0;
+    int joined = 1;  // we're reading everything from the top.
+    // a fresh Io is probably at the start already, but make sure.
+    const int rewound = (!io->seek || (io->seek(io, 0) != -1));
+
+    Thread_LowerPriority();
+
+    memset(&found, '\0', sizeof (found));
+    ogg_sync_init(&sync);
+
+    while (rewound && !AtomicGetUInt(&ctx->halt))
+    {
+        const long rc = ogg_sync_pageseek(&sync, &page);
+        if (rc == 0)
+        {
+            if (FeedMoreOggData(io, &sync, ctx->adaptiveread ? READ_CHUNK_DEFAULT : ctx->readchunk) <= 0)
+                break;  // end of stream (or i/o error).
+        } // if
+        else if (rc < 0)
+        {
+            offset += -rc;  // skipped some junk.
+            joined = 0;  // ...which might have been a page we wanted.
+        } // else if
+        else
+        {
+            if (IsSeekIndexPage(ctx, &page))
+            {
+                if (!GrowSeekIndex(&ctx->allocator, &found))
+                    break;  // out of memory; keep what we have.
+                found.entries[found.len].offset = offset;
+                found.entries[found.len].granulepos = ogg_page_granulepos(&page);
+                found.entries[found.len].joined = joined;
+                found.len++;
+                joined = 1;
+            } // if
+            offset += rc;
+        } // else
+    } // while
+
+    // keep what we got even if we didn't finish; it's all good data.
+    Mutex_Lock(ctx->indexlock);
+    MergeSeekIndex(&ctx->allocator, &ctx->seekindex, &found);
+    Mutex_Unlock(ctx->indexlock);
+
+    FreeSeekIndex(&ctx->allocator, &found);
+    ogg_sync_clear(&sync);
+    io->close(io);
+    AtomicSetUInt(&ctx->scanning, 0);
+    return NULL;
+} // IndexScanThread
+
+
+// Ogg Skeleton headers are little-endian.
+static ogg_int64_t SkeletonReadLE(const unsigned char *ptr, int bytes)
+{
+    ogg_uint64_t retval = 0;
+    while (bytes--)
+        retval = (retval << 8) | ptr[bytes];
+    return (ogg_int64_t) retval;
+} // SkeletonReadLE
+
+// Skeleton's variable-length ints are seven bits at a time, lowest first,
+//  and the high bit marks the _last_ byte. Returns NULL if we run off the end.
+static const unsigned char *SkeletonReadVarint(const unsigned char *ptr, const unsigned char *end, ogg_int64_t *_val)
+{
+    ogg_uint64_t val = 0;
+    int shift = 0;
+    while ((ptr < end) && (shift < 64))
+    {
+        const unsigned char byte = *(ptr++);
+        val |= ((ogg_uint64_t) (byte & 0x7F)) << shift;
+        if (byte & 0x80)
+        {
+            *_val = (ogg_int64_t) val;
+            return ptr;
+        } // if
+        shift += 7;
+    } // while
+    return NULL;
+} // SkeletonReadVarint
+
+static void FreeSkeletonIndex(const THEORAPLAY_Allocator *allocator, SkeletonIndex *index)
+{
+    if (index->keypoints)
+        allocator->deallocate(allocator, index->keypoints);
+    memset(index, '\0', sizeof (*index));
+} // FreeSkeletonIndex
+
+// Is this a Skeleton 4 fishead? Older versions don't have keyframe indexes,
+//  so we don't care about them.
+static int IsSkeletonHead(TheoraDecoder *ctx, const ogg_packet *packet)
+{
+    if ((packet->bytes < 80) || (memcmp(packet->packet, "fishead\0", 8) != 0))
+        return 0;
+    else if (SkeletonReadLE(packet->packet + 8, 2) < 4)
+        return 0;  // major version.
+    ctx->skelsegmentlen = SkeletonReadLE(packet->packet + 64, 8);
+    return 1;
+} // IsSkeletonHead
+
+static void ReadSkeletonIndex(TheoraDecoder *ctx, const ogg_packet *packet)
+{
+    const unsigned char *ptr = packet->packet;
+    const unsigned char *end = ptr + packet->bytes;
+    SkeletonIndex *index = NULL;
+    SkeletonKeypoint *keypoints;
+    ogg_int64_t count, denom;
+    ogg_int64_t offset = 0;
+    ogg_int64_t time = 0;
+    unsigned int i;
+    int serialno;
+
+    if (packet->bytes < 42)
+        return;
+
+    serialno = (int) SkeletonReadLE(ptr + 6, 4);
+    count = SkeletonReadLE(ptr + 10, 8);
+    denom = SkeletonReadLE(ptr + 18, 8);
+
+    if (ctx->tpackets && (serialno == ctx->tserialno))
+        index = &ctx->tskelindex;
+    else if (ctx->vpackets && (serialno == ctx->vserialno))
+        index = &ctx->vskelindex;
+
+    if (!index || index->keypoints)
+        return;  // not a stream we're playing, or a duplicate.
+    else if ((denom <= 0) || (count <= 0) || (count > ((packet->bytes - 42) / 2)))
+        return;  // corrupt (each keypoint is at least two bytes).
+    else if (count > (0xFFFFFFFF / sizeof (SkeletonKeypoint)))
+        return;
+
+    keypoints = (SkeletonKeypoint *) ctx->allocator.allocate(&ctx->allocator, sizeof (SkeletonKeypoint) * (unsigned int) count);
+    if (!keypoints)
+        return;  // oh well, we'll bisect.
+
+    ptr += 42;
+    for (i = 0; i < (unsigned int) count; i++)
+    {
+        ogg_int64_t delta;
+        if ((ptr = SkeletonReadVarint(ptr, end, &delta)) == NULL)
+            break;
+        offset += delta;
+        if ((ptr = SkeletonReadVarint(ptr, end, &delta)) == NULL)
+            break;
+        time += delta;
+        if ((offset < 0) || (offset > ctx->skelsegmentlen) || (time < 0))
+            break;
+        keypoints[i].offset = offset;
+        keypoints[i].ms = ((time / denom) * 1000) + (((time % denom) * 1000) / denom);
+    } // for
+
+    if (i < (unsigned int) count)  // ran out of packet, or nonsense.
+    {
+        ctx->allocator.deallocate(&ctx->allocator, keypoints);
+        return;
+    } // if
+
+    index->keypoints = keypoints;
+    index->len = (unsigned int) count;
+} // ReadSkeletonIndex
+
+// Skeleton's secondary headers are fisbones (which we don't need) and
+//  indexes. An empty eos packet ends them.
+static void ReadSkeletonPackets(TheoraDecoder *ctx)
+{
+    ogg_packet packet;
+
+    ogg_stream_pagein(&ctx->skelstream, &ctx->page);
+    while (ctx->skelpackets && (ogg_stream_packetout(&ctx->skelstream, &packet) == 1))
+    {
+        if (packet.e_o_s || (packet.bytes == 0))
+        {
+            ogg_stream_clear(&ctx->skelstream);
+            ctx->skelpackets = 0;
+        } // if
+        else if ((packet.bytes >= 6) && (memcmp(packet.packet, "index\0", 6) == 0))
+        {
+            ReadSkeletonIndex(ctx, &packet);
+        } // else if
+    } // while
+} // ReadSkeletonPackets
+
+// Latest keypoint at or before targetms, or -1.
+static ogg_int64_t SkeletonIndexLookup(const SkeletonIndex *index, const unsigned long targetms)
+{
+    unsigned int lo = 0;
+    unsigned int hi = index->len;
+    while (lo < hi)
+    {
+        const unsigned int mid = lo + ((hi - lo) / 2);
+        if (index->keypoints[mid].ms <= (ogg_int64_t) targetms)
+            lo = mid + 1;
+        else
+            hi = mid;
+    } // while
+    return (lo > 0) ? index->keypoints[lo - 1].offset : -1;
+} // SkeletonIndexLookup
+
+// Where to start decoding to reach targetms, according to the file's own
+//  keyframe index, or -1 if it doesn't have a usable one. With both audio
+//  and video, start wherever the earlier stream needs to.
+static ogg_int64_t SkeletonSeekOffset(TheoraDecoder *ctx, const unsigned long targetms)
+{
+    ogg_int64_t offset, other;
+
+    if (ctx->skelsegmentlen != ctx->streamlen)
+        return -1;  // missing, or the file changed after it was indexed.
+
+    offset = SkeletonIndexLookup(ctx->tpackets ? &ctx->tskelindex : &ctx->vskelindex, targetms);
+    if ((offset >= 0) && ctx->tpackets && ctx->vpackets)
+    {
+        other = SkeletonIndexLookup(&ctx->vskelindex, targetms);
+        if ((other >= 0) && (other < offset))
+            offset = other;
+    } // if
+    return offset;
+} // SkeletonSeekOffset
+
+
+static void QueueOggPage(TheoraDecoder *ctx)
+{
+    IndexOggPage(ctx);
+
+    if (ctx->skelpackets)
+        ReadSkeletonPackets(ctx);
+
+    // make sure we initialized the stream before using pagein, but the stream
+    //  will know to ignore pages that aren't meant for it, so pass to both.
+    if (ctx->tpackets)
+        ogg_stream_pagein(&ctx->tstream, &ctx->page);
+    if (ctx->vpackets)
+        ogg_stream_pagein(&ctx->vstream, &ctx->page);
+}
+
+// Frames we decode just to reach a seek target are never shown, so there's no
+//  point in post-processing them. Only calls into Theora when it changes.
+static void SetPostProcessing(TheoraDecoder *ctx, int level)
+{
+    if (level != ctx->pplevel_applied)
+    {
+        th_decode_ctl(ctx->tdec, TH_DECCTL_SET_PPLEVEL, &level, sizeof (level));
+        ctx->pplevel_applied = level;
+    } // if
+} // SetPostProcessing
+
+// Pick the post-processing level for the frames we show. In adaptive mode,
+//  we step it up when we've been filling the app's queue, since that means
+//  we're well ahead, and back down as soon as the queue runs low. We never
+//  get here while the queue is full (we stop pumping first), so we go by
+//  ctx->ppahead instead of looking at the queue for that.
+static void UpdatePostProcessing(TheoraDecoder *ctx)
+{
+    const unsigned int request = AtomicGetUInt(&ctx->pprequest);
+    const int maxlevel = (int) AtomicGetUInt(&ctx->pplevel_max);
+    const int ahead = ctx->ppahead;
+    int level = ctx->pplevel;
+
+    ctx->ppahead = 0;
+
+    if (request != PPLEVEL_ADAPTIVE)
+        level = ((int) request < maxlevel) ? (int) request : maxlevel;
+    else
+    {
+        const unsigned int queued = AtomicGetUInt(&ctx->videoqueue.count);
+        if (ctx->ppsettle > 0)
+            ctx->ppsettle--;
+
+        if ((queued <= (ctx->maxframes / 4)) && (level > 0))
+            level--;
+        else if (ahead && (level < maxlevel) && (ctx->ppsettle == 0))
+            level++;
+    } // else
+
+    if (level != ctx->pplevel)
+    {
+        ctx->pplevel = level;
+        ctx->ppsettle = PPLEVEL_SETTLE_FRAMES;
+        AtomicSetUInt(&ctx->pplevel_shown, (unsigned int) level);
+    } // if
+
+    SetPostProcessing(ctx, level);
+} // UpdatePostProcessing
+
+// this currently blocks, so plan ahead if pumping and not threading.
+static void PrepareDecoder(TheoraDecoder *ctx)
+{
+    while (!AtomicGetUInt(&ctx->halt) && ctx->bos)
+    {
+        if (FeedDecoder(ctx, 0) <= 0)
+            goto cleanup;
+
+        // parse out the initial header.
+        while ( (!AtomicGetUInt(&ctx->halt)) && (NextOggPage(ctx) > 0) )
+        {
+            ogg_stream_state test;
+            int serialno;
+
+            if (!ogg_page_bos(&ctx->page))  // not a header.
+            {
+                QueueOggPage(ctx);
+                ctx->bos = 0;
+                break;
+            } // if
+
+            serialno = ogg_page_serialno(&ctx->page);
+            ogg_stream_init(&test, serialno);
+            ogg_stream_pagein(&test, &ctx->page);
+            ogg_stream_packetout(&test, &ctx->packet);
+
+            if (!ctx->tpackets && (th_decode_headerin(&ctx->tinfo, &ctx->tcomment, &ctx->tsetup, &ctx->packet) >= 0))
+            {
+                memcpy(&ctx->tstream, &test, sizeof (test));
+                ctx->tpackets = 1;
+                ctx->tserialno = serialno;
+            } // if
+            else if (!ctx->vpackets && (vorbis_synthesis_headerin(&ctx->vinfo, &ctx->vcomment, &ctx->packet) >= 0))
+            {
+                memcpy(&ctx->vstream, &test, sizeof (test));
+                ctx->vpackets = 1;
+                ctx->vserialno = serialno;
+            } // else if
+            else if (!ctx->skelpackets && IsSkeletonHead(ctx, &ctx->packet))
+            {
+                memcpy(&ctx->skelstream, &test, sizeof (test));
+                ctx->skelpackets = 1;
+            } // else if
+            else
+            {
+                // whatever it is, we don't care about it
+                ogg_stream_clear(&test);
+            } // else
+        } // while
+    } // while
+
+    // no audio OR video?
+    if (AtomicGetUInt(&ctx->halt) || (!ctx->vpackets && !ctx->tpackets))
+        goto cleanup;
+
+    // apparently there are two more theora and two more vorbis headers next.
+    while ((!AtomicGetUInt(&ctx->halt)) && ((ctx->tpackets && (ctx->tpackets < 3)) || (ctx->vpackets && (ctx->vpackets < 3))))
+    {
+        while (!AtomicGetUInt(&ctx->halt) && ctx->tpackets && (ctx->tpackets < 3))
+        {
+            if (ogg_stream_packetout(&ctx->tstream, &ctx->packet) != 1)
+                break; // get more data?
+            if (!th_decode_headerin(&ctx->tinfo, &ctx->tcomment, &ctx->tsetup, &ctx->packet))
+                goto cleanup;
+            ctx->tpackets++;
+        } // while
+
+        while (!AtomicGetUInt(&ctx->halt) && ctx->vpackets && (ctx->vpackets < 3))
+        {
+            if (ogg_stream_packetout(&ctx->vstream, &ctx->packet) != 1)
+                break;  // get more data?
+            if (vorbis_synthesis_headerin(&ctx->vinfo, &ctx->vcomment, &ctx->packet))
+                goto cleanup;
+            ctx->vpackets++;
+        } // while
+
+        // get another page, try again?
+        if (NextOggPage(ctx) > 0)
+            QueueOggPage(ctx);
+        else if (FeedDecoder(ctx, 0) <= 0)
+            goto cleanup;
+    } // while
+
+    // okay, now we have our streams, ready to set up decoding.
+    if (!AtomicGetUInt(&ctx->halt) && ctx->tpackets)
+    {
+        // th_decode_alloc() docs say to check for insanely large frames yourself.
+        if ((ctx->tinfo.frame_width > 99999) || (ctx->tinfo.frame_height > 99999))
+            goto cleanup;
+
+        // We treat "unspecified" as NTSC. *shrug*
+        if ( (ctx->tinfo.colorspace != TH_CS_UNSPECIFIED) &&
+             (ctx->tinfo.colorspace != TH_CS_ITU_REC_470M) &&
+             (ctx->tinfo.colorspace != TH_CS_ITU_REC_470BG) )
+        {
+            assert(0 && "Unsupported colorspace.");  // !!! FIXME
+            goto cleanup;
+        } // if
+
+        if (ctx->tinfo.pixel_fmt != TH_PF_420) { assert(0); goto cleanup; } // !!! FIXME
+
+        if (ctx->tinfo.fps_denominator != 0)
+            ctx->fps = ((double) ctx->tinfo.fps_numerator) / ((double) ctx->tinfo.fps_denominator);
+
+        ctx->tdec = th_decode_alloc(&ctx->tinfo, ctx->tsetup);
+        if (!ctx->tdec) goto cleanup;
+
+        ctx->outwidth = ctx->tinfo.pic_width;
+        ctx->outheight = ctx->tinfo.pic_height;
+        if ((ctx->options.output_width >= 2) && (ctx->options.output_height >= 2))
+        {
+            ctx->outwidth = ctx->options.output_width & ~1;  // 4:2:0 wants even sizes.
+            ctx->outheight = ctx->options.output_height & ~1;
+            ctx->scaling = (ctx->outwidth != ctx->tinfo.pic_width) || (ctx->outheight != ctx->tinfo.pic_height);
+        } // if
+
+        memset(&ctx->outinfo, '\0', sizeof (th_info));  // the converters only look at the picture rectangle.
+        ctx->outinfo.frame_width = ctx->outinfo.pic_width = ctx->outwidth;
+        ctx->outinfo.frame_height = ctx->outinfo.pic_height = ctx->outheight;
+        ctx->outinfo.pixel_fmt = TH_PF_420;
+
+        if (ctx->scaling)
+        {
+            const unsigned int scratchlen = ScaleScratchSize(ctx);
+            unsigned int i;
+            ctx->scalescratch = (unsigned char *) ctx->allocator.allocate(&ctx->allocator, scratchlen);
+            if (!ctx->scalescratch) goto cleanup;
+            for (i = 0; i < ctx->cvthelpercount; i++)
+            {
+                ctx->cvthelpers[i].scalescratch = (unsigned char *) ctx->allocator.allocate(&ctx->allocator, scratchlen);
+                if (!ctx->cvthelpers[i].scalescratch) goto cleanup;
+            } // for
+        } // if
+
+        // Post-processing starts off, unless the app already asked for some.
+        //  See THEORAPLAY_setPostProcessingLevel().
+        int pp_level_max = 0;
+        if (th_decode_ctl(ctx->tdec, TH_DECCTL_GET_PPLEVEL_MAX, &pp_level_max, sizeof (pp_level_max)) != 0)
+            pp_level_max = 0;
+        AtomicSetUInt(&ctx->pplevel_max, (unsigned int) pp_level_max);
+        ctx->pplevel = 0;
+        ctx->pplevel_applied = -1;
+        UpdatePostProcessing(ctx);
+    } // if
+
+    // Done with this now.
+    if (ctx->tsetup != NULL)
+    {
+        th_setup_free(ctx->tsetup);
+        ctx->tsetup = NULL;
+    } // if
+
+    if (!AtomicGetUInt(&ctx->halt) && ctx->vpackets)
+    {
+        ctx->vdsp_init = (vorbis_synthesis_init(&ctx->vdsp, &ctx->vinfo) == 0);
+        if (!ctx->vdsp_init)
+            goto cleanup;
+        ctx->vblock_init = (vorbis_block_init(&ctx->vdsp, &ctx->vblock) == 0);
+        if (!ctx->vblock_init)
+            goto cleanup;
+    } // if
+
+    // Now we can start the actual decoding!
+    // Note that audio and video don't _HAVE_ to start simultaneously.
+
+    // Just check this once in case it's expensive. Seeking needs it, and it
+    //  tells saved seek indexes apart.
+    if (ctx->io->seek && ctx->io->streamlen)
+        ctx->streamlen = ctx->io->streamlen(ctx->io);
+
+    AtomicSetUInt(&ctx->hasvideo, (ctx->tpackets != 0));
+    AtomicSetUInt(&ctx->hasaudio, (ctx->vpackets != 0));
+    AtomicSetUInt(&ctx->prepped, 1);  // last, so the others are visible once this is.
+
+cleanup:  // we will do actual cleanup when closing the decoder.
+    return;
+}
+
+// Hand the decoder's current picture to the app (or the pipeline). Returns
+//  1 if we did, 0 if the decoder had nothing for us, -1 on error.
+static int EmitVideoFrame(TheoraDecoder *ctx, const unsigned int playms)
+{
+    th_ycbcr_buffer ycbcr;
+    THEORAPLAY_VideoFormat layoutfmt;
+    unsigned int pixelslen;
+    VideoFrame *item;
+
+    if (th_decode_ycbcr_out(ctx->tdec, ycbcr) != 0)
+        return 0;
+
+    // scaled THEORAPLAY_VIDFMT_PLANES frames can't keep the decoder's strides,
+    //  so they're laid out like IYUV.
+    layoutfmt = ((ctx->vidfmt == THEORAPLAY_VIDFMT_PLANES) && ctx->scaling) ? THEORAPLAY_VIDFMT_IYUV : ctx->vidfmt;
+    pixelslen = (layoutfmt == THEORAPLAY_VIDFMT_PLANES) ? PlanesBufferSize(&ctx->tinfo, ycbcr) : VideoFrameBufferSize(layoutfmt, &ctx->outinfo);
+    item = GetPooledVideoFrame(ctx->framepool, pixelslen);
+    if (item == NULL)
+        return -1;
+    item->seek_generation = ctx->current_seek_generation;
+    item->playms = playms;
+    item->fps = ctx->fps;
+    item->width = ctx->outwidth;
+    item->height = ctx->outheight;
+    item->format = layoutfmt;
+    SetVideoFramePlanes(item);
+    item->format = ctx->vidfmt;
+
+    if (layoutfmt == THEORAPLAY_VIDFMT_PLANES)
+    {
+        CopyVideoFramePlanes(&ctx->tinfo, ycbcr, item);
+        if (!QueueVideoFrame(ctx, item))
+            return -1;
+    } // if
+    else if (!ctx->pipeline_created)
+    {
+        ConvertVideoFrame(ctx, ycbcr, item->pixels);
+        if (!QueueVideoFrame(ctx, item))
+            return -1;
+    } // else if
+    else if (!PipelineSubmit(ctx, item, ycbcr))
+    {
+        ReleasePooledVideoFrame(item);
+        return -1;
+    } // else if
+
+    return 1;
+} // EmitVideoFrame
+
+// When Theora's end-of-frame time would be for a frame number.
+static unsigned long VideoFrameMs(TheoraDecoder *ctx, const ogg_int64_t frame)
+{
+    if (ctx->tinfo.fps_numerator == 0)
+        return 0;
+    return (unsigned long) ((((double) (frame + 1)) * ((double) ctx->tinfo.fps_denominator) * 1000.0) / ((double) ctx->tinfo.fps_numerator));
+} // VideoFrameMs
+
+// Has the app's playback clock already gone a whole frame past this one? We
+//  still decode late frames, since the next ones are built on them, but
+//  nobody will see them, so they don't need converting or queueing. If the
+//  app has nothing else queued to show, though, a late frame beats none.
+static int VideoFrameIsLate(TheoraDecoder *ctx, const unsigned int playms)
+{
+    const unsigned int clock = AtomicGetUInt(&ctx->playclock);
+    const unsigned int framems = (ctx->fps > 0.0) ? (unsigned int) (1000.0 / ctx->fps) : 0;
+
+    if ((clock == 0) || ((clock - 1) < playms))
+        return 0;
+    else if (((clock - 1) - playms) < framems)
+        return 0;
+    return (AtomicGetUInt(&ctx->videoqueue.count) > 0);
+} // VideoFrameIsLate
+
+// Emit the keyframe we're holding, and stop until the next seek.
+static int FinishScrub(TheoraDecoder *ctx)
+{
+    const unsigned int playms = (unsigned int) ((ctx->scrubkey >= 0) ? VideoFrameMs(ctx, ctx->scrubkey) : ctx->seek_target);
+    const int rc = EmitVideoFrame(ctx, playms);
+    ctx->scrubbing = 0;
+    ctx->scrub_parked = 1;
+    return rc;
+} // FinishScrub
+
+// While scrubbing, we only decode keyframes, and only hand over the last one
+//  at or before the target. Theora counts frames as we feed it packets, but we
+//  skip most of them, so we count for ourselves. Returns 1 if we're done, 0 to
+//  keep going, -1 on error.
+static int ScrubVideoPacket(TheoraDecoder *ctx)
+{
+    const ogg_packet *packet = &ctx->packet;
+    const int iskeyframe = (th_packet_iskeyframe(&ctx->packet) == 1);
+    ogg_int64_t frame = -1;  // this packet's frame number, if we know it.
+
+    if (packet->granulepos >= 0)
+        frame = th_granule_frame(ctx->tdec, packet->granulepos);
+    else if (ctx->scrubnext >= 0)
+        frame = ctx->scrubnext;
+    ctx->scrubnext = (frame >= 0) ? (frame + 1) : -1;
+
+    // the first granulepos after an untimed keyframe tells us when it was.
+    if (!iskeyframe && (packet->granulepos >= 0) && (ctx->scrubkey == SCRUBKEY_UNTIMED))
+        ctx->scrubkey = SeekIndexKeyframe(ctx, packet->granulepos);
+
+    if ((frame >= 0) && (VideoFrameMs(ctx, frame) > ctx->seek_target))  // gone past the target?
+    {
+        if (ctx->scrubkey != SCRUBKEY_NONE)
+            return FinishScrub(ctx);
+        else if (!iskeyframe)
+            return 0;  // the nearest keyframe we can reach is still ahead.
+    } // if
+
+    if (iskeyframe)
+    {
+        if (packet->granulepos >= 0)
+            th_decode_ctl(ctx->tdec, TH_DECCTL_SET_GRANPOS, &ctx->packet.granulepos, sizeof (ctx->packet.granulepos));
+        if (th_decode_packetin(ctx->tdec, &ctx->packet, NULL) != 0)
+            return 0;  // corrupt? Wait for the next one.
+        ctx->scrubkey = (frame >= 0) ? frame : SCRUBKEY_UNTIMED;
+        if ((frame >= 0) && (VideoFrameMs(ctx, frame) > ctx->seek_target))
+            return FinishScrub(ctx);  // nothing before the target to be had, so this is as close as it gets.
+    } // if
+
+    return 0;
+} // ScrubVideoPacket
+
+
+// Where to probe next when searching for a page that ends around aimms,
+//  between stream offsets lo and hi, whose pages end at lotime and hitime.
+//  Once we know both times, we guess by interpolating between them instead
+//  of splitting the difference, since bitrates don't usually vary that much.
+//  The guess stays an eighth of the range away from either end, though, so
+//  lopsided content can't make us creep up on the target a sliver at a time.
+static ogg_int64_t SeekProbePosition(const ogg_int64_t lo, const ogg_int64_t hi, const unsigned long lotime,
+                                     const long hitime, const unsigned long aimms)
+{
+    const ogg_int64_t range = hi - lo;
+    const ogg_int64_t margin = range / 8;
+    ogg_int64_t pos;
+
+    if ((hitime < 0) || (((unsigned long) hitime) <= lotime))
+        return lo + (range / 2);  // nothing to go on yet.
+    else if (aimms <= lotime)
+        return lo + margin;
+
+    pos = lo + (ogg_int64_t) ((((double) range) * ((double) (aimms - lotime))) / ((double) (((unsigned long) hitime) - lotime)));
+    if (pos < (lo + margin))
+        pos = lo + margin;
+    else if (pos > (hi - margin))
+        pos = hi - margin;
+    return pos;
+} // SeekProbePosition
+
+
+// This massive function is where all the effort happens.
+static int PumpDecoder(TheoraDecoder *ctx, int desired_frames)
+{
+    int had_new_video_frames = 0;
+
+    if (!AtomicGetUInt(&ctx->prepped))
+    {
+        PrepareDecoder(ctx);
+        return 0;
+    } // if
+
+    if (AtomicGetUInt(&ctx->thread_done))
+        return 0;
+
+    while (!AtomicGetUInt(&ctx->halt) && !ctx->eos && (desired_frames > 0))
+    {
+        int need_pages = 0;  // need more Ogg pages?
+
+        if (ctx->current_seek_generation != AtomicGetUInt(&ctx->seek_generation))  // seek requested
+        {
+            unsigned long targetms;
+            ogg_int64_t seekpos;
+            ogg_int64_t lo, hi;
+            unsigned long lotime;
+            long hitime;
+            unsigned long minlead = 500;  // how far before the target we want to start decoding.
+            unsigned long maxlead = 1000;
+            int found = 0;
+
+            if (!ctx->io->seek)
+                goto cleanup;  // seeking unsupported.
+
+            if (ctx->streamlen == -1)
+                goto cleanup;  // i/o error, unsupported, etc.
+
+            AdviseMapping(ctx, 1);
+
+            // We check ctx->seek_generation without a lock as this goes on, so if they mismatch we
+            //  drop what we're doing and prepare to seek to a new location. But here we hold a lock
+            //  so we can avoid the race condition where the app is halfway through requesting a
+            //  seek while we're reading in these variables.
+            Mutex_Lock(ctx->lock);
+            ctx->current_seek_generation = AtomicGetUInt(&ctx->seek_generation);
+            targetms = ctx->new_seek_position_ms;
+            ctx->scrubbing = ctx->new_seek_keyframe && ctx->tpackets;
+            Mutex_Unlock(ctx->lock);
+
+            ctx->scrub_parked = 0;
+            ctx->scrubkey = SCRUBKEY_NONE;
+            ctx->scrubnext = -1;
+            if (ctx->scrubbing)
+            {
+                // start far enough back that we can't miss the target's keyframe.
+                unsigned long keyframems = VideoFrameMs(ctx, (((ogg_int64_t) 1) << ctx->tinfo.keyframe_granule_shift) - 1);
+                if (keyframems > 10000)
+                    keyframems = 10000;  // that's silly; take our chances.
+                minlead += keyframems;
+                maxlead += keyframems;
+            } // if
+
+            lo = 0;
+            hi = ctx->streamlen;
+
+            if (targetms < maxlead)
+                hi = 0;  /* as an optimization, just jump to the start of file if seeking within the first second, instead of binary searching. */
+            else if ((seekpos = SkeletonSeekOffset(ctx, targetms)) >= 0)
+            {
+                // the file told us where the keyframe is.
+                if (ctx->io->seek(ctx->io, seekpos) == -1)
+                    goto cleanup;  // oh well.
+                ResetOggSync(ctx, seekpos);
+                found = 1;
+            } // else if
+            else
+            {
+                // if we've already played through this part, we know where its keyframe is.
+                ogg_int64_t target;
+                if (ctx->tpackets)
+                    target = (ogg_int64_t) ((((double) targetms) * ctx->tinfo.fps_numerator) / (((double) ctx->tinfo.fps_denominator) * 1000.0));
+                else
+                    target = (((ogg_int64_t) targetms) * ctx->vinfo.rate) / 1000;
+
+                Mutex_Lock(ctx->indexlock);
+                seekpos = SeekIndexLookup(ctx, target);
+                Mutex_Unlock(ctx->indexlock);
+
+                if (seekpos >= 0)
+                {
+                    if (ctx->io->seek(ctx->io, seekpos) == -1)
+                        goto cleanup;  // oh well.
+                    ResetOggSync(ctx, seekpos);
+                    found = 1;
+                } // if
+            } // else
+
+            // Search the stream for a page that ends 500 to 1000 milliseconds
+            //  before the target (plus a keyframe interval, if scrubbing), so
+            //  we catch the keyframe on the way in.
+            // This idea came from libtheoraplayer (no relation to theoraplay).
+            lotime = 0;
+            hitime = -1;  // don't know until we probe past the target.
+            seekpos = SeekProbePosition(lo, hi, lotime, hitime, targetms - ((minlead + maxlead) / 2));
+
+            while ((!found) && (!AtomicGetUInt(&ctx->halt)) && (ctx->current_seek_generation == AtomicGetUInt(&ctx->seek_generation)))
+            {
+                //const int max_keyframe_distance = 1 << ctx->tinfo.keyframe_granule_shift;
+
+                if (ctx->io->seek(ctx->io, seekpos) == -1)
+                    goto cleanup;  // oh well.
+
+                ResetOggSync(ctx, seekpos);
+
+                while (!AtomicGetUInt(&ctx->halt) && (ctx->current_seek_generation == AtomicGetUInt(&ctx->seek_generation)))
+                {
+                    if (NextOggPage(ctx) != 1)
+                    {
+                        if (FeedDecoder(ctx, 1) <= 0)
+                            goto cleanup;
+                        continue;
+                    } // if
+
+                    ctx->granulepos = ogg_page_granulepos(&ctx->page);
+                    if (ctx->granulepos >= 0)
+                    {
+                        const int serialno = ogg_page_serialno(&ctx->page);
+                        unsigned long ms;
+
+                        if (ctx->tpackets)  // always tee off video frames if possible.
+                        {
+                            if (serialno != ctx->tserialno)
+                                continue;
+                            ms = (unsigned long) (th_granule_time(ctx->tdec, ctx->granulepos) * 1000.0);
+                        } // else
+                        else
+                        {
+                            if (serialno != ctx->vserialno)
+                                continue;
+                            ms = (unsigned long) (vorbis_granule_time(&ctx->vdsp, ctx->granulepos) * 1000.0);
+                        } // else
+
+                        if ((ms < targetms) && ((targetms - ms) >= minlead) && ((targetms - ms) <= maxlead))   // !!! FIXME: tweak this number?
+                            found = 1;  // found something close enough to the target!
+                        else if ((ms < targetms) && ((targetms - ms) > maxlead))
+                        {
+                            lo = ctx->syncpos;  // everything up to the end of this page is too early.
+                            lotime = ms;
+                        } // else if
+                        else
+                        {
+                            hi = seekpos;  // everything from here on is too late.
+                            hitime = (long) ms;
+                        } // else
+                        break;
+                    } // if
+                } // while
+
+                if (found)
+                    break;
+                else if (hi <= lo)
+                    break;  // we did the best we could, just go from here.
+
+                const ogg_int64_t newseekpos = SeekProbePosition(lo, hi, lotime, hitime, targetms - ((minlead + maxlead) / 2));
+                if (seekpos == newseekpos)
+                    break;  // we did the best we could, just go from here.
+                seekpos = newseekpos;
+            } // while
+
+            // at this point, we have seek'd to something reasonably close to our target. Now decode until we're as close as possible to it.
+            AdviseMapping(ctx, 0);
+            vorbis_synthesis_restart(&ctx->vdsp);
+            ctx->resolving_audio_seek = ctx->vpackets;
+            ctx->resolving_video_seek = ctx->tpackets;
+            ctx->seek_target = targetms;
+            ctx->need_keyframe = ctx->tpackets;
+            AtomicSetUInt(&ctx->catchup_frames, 0);
+            if (ctx->tpackets && !ctx->scrubbing)
+                SetPostProcessing(ctx, 0);  // nobody sees the catch-up frames.
+        } // if
+
+        if (ctx->scrub_parked)
+            break;  // showing a keyframe until the app seeks again.
+
+        // Try to read as much audio as we can at once. We limit the outer
+        //  loop to one video frame and as much audio as we can eat.
+        while (!AtomicGetUInt(&ctx->halt) && ctx->vpackets)
+        {
+            const double audiotime = vorbis_granule_time(&ctx->vdsp, ctx->vdsp.granulepos);
+            const unsigned int playms = (unsigned int) (audiotime * 1000.0);
+            float **pcm = NULL;
+            int frames;
+
+            if (ctx->current_seek_generation != AtomicGetUInt(&ctx->seek_generation))
+                break;  // seek requested? Break out of the loop right away so we can handle it; this loop's work would be wasted.
+
+            if (ctx->scrubbing)  // nobody's listening while scrubbing, so don't bother decoding.
+            {
+                while (ogg_stream_packetout(&ctx->vstream, &ctx->packet) > 0) { /* spin */ }
+                break;
+            } // if
+
+            if (ctx->resolving_audio_seek)
+            {
+                if (ctx->seek_target < 1000)   // if the seek target is the start of the data, assume we're good even before audiotime is valid. As soon as we have data, ship it.
+                    ctx->resolving_audio_seek = 0;
+                else if ((audiotime >= 0.0) && ((playms >= ctx->seek_target) || ((ctx->seek_target - playms) <= (unsigned long) (1000.0 / ctx->fps))))
+                    ctx->resolving_audio_seek = 0;
+            }
+
+            if (!ctx->tpackets && (audiotime >= 0.0))
+                UpdateReadChunk(ctx, playms);  // no video to time the stream by.
+
+            frames = vorbis_synthesis_pcmout(&ctx->vdsp, &pcm);
+            if (frames > 0)
+            {
+                if (!ctx->resolving_audio_seek)
+                {
+                    const int channels = ctx->vinfo.channels;
+                    int chanidx, frameidx;
+                    float *samples;
+                    AudioPacket *item = (AudioPacket *) ctx->allocator.allocate(&ctx->allocator, sizeof (AllocatedAudioPacket));
+                    if (item == NULL) goto cleanup;
+                    memcpy(&((AllocatedAudioPacket *) item)->allocator, &ctx->allocator, sizeof (THEORAPLAY_Allocator));
+                    item->seek_generation = ctx->current_seek_generation;
+                    item->playms = playms;
                     item->channels = channels;
                     item->freq = ctx->vinfo.rate;
                     item->frames = frames;
                     item->samples = (float *) ctx->allocator.allocate(&ctx->allocator, sizeof (float) * frames * channels);
                     item->next = NULL;
 
-                    if (item->samples == NULL)
-                    {
-                        free(item);
-                        goto cleanup;
-                    } // if
+                    if (item->samples == NULL)
+                    {
+                        ctx->allocator.deallocate(&ctx->allocator, item);
+                        goto cleanup;
+                    } // if
+
+                    // I bet this beats the crap out of the CPU cache...
+                    samples = item->samples;
+                    for (frameidx = 0; frameidx < frames; frameidx++)
+                    {
+                        for (chanidx = 0; chanidx < channels; chanidx++)
+                            *(samples++) = pcm[chanidx][frameidx];
+                    } // for
+
+                    //printf("Decoded %d frames of audio.\n", (int) frames);
+                    AtomicAddUInt(&ctx->audioms, item->playms);  // before queueing, so the app never sees it underflow.
+                    if (!ItemQueuePush(&ctx->audioqueue, item))
+                    {
+                        AtomicSubUInt(&ctx->audioms, item->playms);
+                        FreeAudioPacket(item);
+                        goto cleanup;
+                    } // if
+                } // if
+
+                vorbis_synthesis_read(&ctx->vdsp, frames);  // we ate everything.
+            } // if
+            else  // no audio available left in current packet?
+            {
+                // try to feed another packet to the Vorbis stream...
+                if (ogg_stream_packetout(&ctx->vstream, &ctx->packet) <= 0)
+                {
+                    if (!ctx->tpackets)
+                        need_pages = 1; // no video, get more pages now.
+                    break;  // we'll get more pages when the video catches up.
+                } // if
+                else
+                {
+                    // Well short of a seek target, we just need Vorbis to keep
+                    //  track of the granulepos; the last half second gets real
+                    //  PCM, so the overlap is right when we start shipping it.
+                    const int trackonly = ctx->resolving_audio_seek && (audiotime >= 0.0) && ((((unsigned long) playms) + 500) < ctx->seek_target);
+                    const int rc = trackonly ? vorbis_synthesis_trackonly(&ctx->vblock, &ctx->packet) : vorbis_synthesis(&ctx->vblock, &ctx->packet);
+                    if (rc == 0)
+                        vorbis_synthesis_blockin(&ctx->vdsp, &ctx->vblock);
+                } // else
+            } // else
+        } // while
+
+        if (!AtomicGetUInt(&ctx->halt) && ctx->tpackets && (ctx->current_seek_generation == AtomicGetUInt(&ctx->seek_generation)))
+        {
+            // Theora, according to example_player.c, is
+            //  "one [packet] in, one [frame] out."
+            if (ogg_stream_packetout(&ctx->tstream, &ctx->packet) <= 0)
+                need_pages = 1;
+            else if (ctx->scrubbing)
+            {
+                const int rc = ScrubVideoPacket(ctx);
+                if (rc < 0)
+                    goto cleanup;
+                else if (rc > 0)
+                    had_new_video_frames = 1;
+            } // else if
+            else
+            {
+                // you have to guide the Theora decoder to get meaningful timestamps, apparently.  :/
+                if (ctx->packet.granulepos >= 0)
+                    th_decode_ctl(ctx->tdec, TH_DECCTL_SET_GRANPOS, &ctx->packet.granulepos, sizeof (ctx->packet.granulepos));
+
+                if (!ctx->resolving_video_seek)
+                    UpdatePostProcessing(ctx);
+
+                // Anything before the keyframe we're waiting on can't be
+                //  decoded correctly anyhow; a zero-byte packet tells Theora
+                //  it's a dropped frame, so it still counts it, for nearly free.
+                if (ctx->need_keyframe && (th_packet_iskeyframe(&ctx->packet) != 1))
+                    ctx->packet.bytes = 0;
+
+                if (th_decode_packetin(ctx->tdec, &ctx->packet, &ctx->granulepos) == 0)  // new frame!
+                {
+                    const double videotime = th_granule_time(ctx->tdec, ctx->granulepos);
+                    const unsigned int playms = (unsigned int) (videotime * 1000.0);
+
+                    if (videotime >= 0.0)
+                        UpdateReadChunk(ctx, playms);
+
+                    if (ctx->need_keyframe && th_packet_iskeyframe(&ctx->packet))
+                        ctx->need_keyframe = 0;
+
+                    if (ctx->resolving_video_seek && !ctx->need_keyframe && ((playms >= ctx->seek_target) || ((ctx->seek_target - playms) <= (unsigned long) (1000.0 / ctx->fps))))
+                    {
+                        ctx->resolving_video_seek = 0;
+                        SetPostProcessing(ctx, ctx->pplevel);
+                    } // if
+                    else if (ctx->resolving_video_seek)
+                    {
+                        // post-processing happens as a frame decodes, so turn it
+                        //  back on before the frame we'll actually land on.
+                        const unsigned long nextms = VideoFrameMs(ctx, th_granule_frame(ctx->tdec, ctx->granulepos) + 1);
+                        AtomicAddUInt(&ctx->catchup_frames, 1);
+                        if (!ctx->need_keyframe && ((nextms >= ctx->seek_target) || ((ctx->seek_target - nextms) <= (unsigned long) (1000.0 / ctx->fps))))
+                            SetPostProcessing(ctx, ctx->pplevel);
+                    } // else if
+
+                    if (!ctx->resolving_video_seek && VideoFrameIsLate(ctx, playms))
+                    {
+                        AtomicAddUInt(&ctx->dropped_frames, 1);
+                        desired_frames--;  // it still cost us a decode.
+                    } // if
+                    else if (!ctx->resolving_video_seek)
+                    {
+                        const int rc = EmitVideoFrame(ctx, playms);
+                        if (rc < 0)
+                            goto cleanup;
+                        else if (rc > 0)
+                        {
+                            desired_frames--;
+
+                            // if we're full, consider this a full pump.
+                            if (VideoQueueFull(ctx))
+                            {
+                                desired_frames = 0;
+                                ctx->ppahead = 1;
+                            } // if
+
+                            had_new_video_frames = 1;
+                        } // else if
+                    } // else if
+                } // if
+            } // else
+        } // if
+
+        if (!AtomicGetUInt(&ctx->halt) && need_pages && (ctx->current_seek_generation == AtomicGetUInt(&ctx->seek_generation)))
+        {
+            const int rc = FeedDecoder(ctx, 0);
+            if ((rc == 0) && ctx->scrubbing && (ctx->scrubkey != SCRUBKEY_NONE))
+            {
+                if (FinishScrub(ctx) < 0)  // ran out of file; the last keyframe is the closest.
+                    goto cleanup;
+                had_new_video_frames = 1;
+            } // if
+
+            if (rc == 0)
+                ctx->eos = 1;  // end of stream
+            else if (rc < 0)
+                goto cleanup;  // i/o error, etc.
+            else
+            {
+                while (!AtomicGetUInt(&ctx->halt) && (NextOggPage(ctx) > 0))
+                    QueueOggPage(ctx);
+            } // else
+        } // if
+    } // while
+
+    ctx->was_error = 0;
+
+cleanup:
+    AtomicSetUInt(&ctx->decode_error, (!AtomicGetUInt(&ctx->halt) && ctx->was_error));
+    if (AtomicGetUInt(&ctx->halt) || ctx->eos || AtomicGetUInt(&ctx->decode_error))
+        PipelineDrain(ctx);  // make sure every frame is queued before we say we're done.
+    AtomicSetUInt(&ctx->thread_done, (AtomicGetUInt(&ctx->halt) || ctx->eos || AtomicGetUInt(&ctx->decode_error)));
+
+    return had_new_video_frames;
+} // PumpDecoder
+
+
+static void *WorkerThread(void *_this)
+{
+#if !THEORAPLAY_ONLY_SINGLE_THREADED
+    TheoraDecoder *ctx = (TheoraDecoder *) _this;
+    while (!AtomicGetUInt(&ctx->thread_done))
+    {
+        const int had_new_video_frames = PumpDecoder(ctx, ctx->maxframes);
+        // Sleep the thread until we have space for more frames, or there's
+        //  a seek or halt to deal with. getVideo, seek and stopDecode post
+        //  wakeworker, so we recheck whenever one of them happens.
+        if ((had_new_video_frames || ctx->scrub_parked) && !AtomicGetUInt(&ctx->thread_done))
+        {
+            int go_on = !AtomicGetUInt(&ctx->halt);
+            //printf("Sleeping.\n");
+            while (go_on)
+            {
+                go_on = !AtomicGetUInt(&ctx->halt) && (ctx->current_seek_generation == AtomicGetUInt(&ctx->seek_generation)) && (VideoQueueFull(ctx) || ctx->scrub_parked);
+                if (go_on)
+                    Semaphore_Wait(ctx->wakeworker);
+            } // while
+            //printf("Awake!\n");
+        } // if
+    }
+
+    //printf("Worker thread is done.\n");
+#endif
+    return NULL;
+} // WorkerThread
+
+
+struct THEORAPLAY_Scheduler
+{
+    THEORAPLAY_Allocator allocator;
+    THEORAPLAY_MUTEX_T lock;
+    THEORAPLAY_SEM_T wake;  // posted whenever an attached decoder might have work.
+    THEORAPLAY_THREAD_T *threads;
+    unsigned int threadcount;
+    int halt;  // guarded by lock.
+    TheoraDecoder *decoders;  // guarded by lock, chained through sched_next.
+};
+
+// Lower is drier. Decoders that aren't prepped yet go first, so apps can
+//  find out what's in the file as soon as possible.
+static unsigned int SchedulerFillLevel(TheoraDecoder *ctx)
+{
+    if (!AtomicGetUInt(&ctx->prepped) || (ctx->maxframes == 0))
+        return 0;
+    return ((AtomicGetUInt(&ctx->videoqueue.count) + AtomicGetUInt(&ctx->videopending)) * 1024) / ctx->maxframes;
+} // SchedulerFillLevel
 
-                    // I bet this beats the crap out of the CPU cache...
-                    samples = item->samples;
-                    for (frameidx = 0; frameidx < frames; frameidx++)
-                    {
-                        for (chanidx = 0; chanidx < channels; chanidx++)
-                            *(samples++) = pcm[chanidx][frameidx];
-                    } // for
+// Call with scheduler->lock held. Same rules WorkerThread sleeps by.
+static int SchedulerCanPump(TheoraDecoder *ctx)
+{
+    if (ctx->sched_busy || AtomicGetUInt(&ctx->thread_done) || AtomicGetUInt(&ctx->halt))
+        return 0;
+    else if (ctx->current_seek_generation != AtomicGetUInt(&ctx->seek_generation))
+        return 1;  // get started on the seek right away.
+    return !VideoQueueFull(ctx) && !ctx->scrub_parked;
+} // SchedulerCanPump
 
-                    //printf("Decoded %d frames of audio.\n", (int) frames);
-                    Mutex_Lock(ctx->lock);
-                    ctx->audioms += item->playms;
-                    if (ctx->audiolisttail)
-                    {
-                        assert(ctx->audiolist);
-                        ctx->audiolisttail->next = item;
-                    } // if
-                    else
-                    {
-                        assert(!ctx->audiolist);
-                        ctx->audiolist = item;
-                    } // else
-                    ctx->audiolisttail = item;
-                    Mutex_Unlock(ctx->lock);
-                } // if
+static void *SchedulerThread(void *_this)
+{
+    THEORAPLAY_Scheduler *sched = (THEORAPLAY_Scheduler *) _this;
 
-                vorbis_synthesis_read(&ctx->vdsp, frames);  // we ate everything.
-            } // if
-            else  // no audio available left in current packet?
+    Mutex_Lock(sched->lock);
+    while (!sched->halt)
+    {
+        TheoraDecoder *best = NULL;
+        unsigned int bestfill = 0;
+        TheoraDecoder *ctx;
+
+        for (ctx = sched->decoders; ctx != NULL; ctx = ctx->sched_next)
+        {
+            if (SchedulerCanPump(ctx))
             {
-                // try to feed another packet to the Vorbis stream...
-                if (ogg_stream_packetout(&ctx->vstream, &ctx->packet) <= 0)
+                const unsigned int fill = SchedulerFillLevel(ctx);
+                if ((best == NULL) || (fill < bestfill))
                 {
-                    if (!ctx->tpackets)
-                        need_pages = 1; // no video, get more pages now.
-                    break;  // we'll get more pages when the video catches up.
+                    best = ctx;
+                    bestfill = fill;
                 } // if
-                else
-                {
-                    if (vorbis_synthesis(&ctx->vblock, &ctx->packet) == 0)
-                        vorbis_synthesis_blockin(&ctx->vdsp, &ctx->vblock);
-                } // else
-            } // else
-        } // while
+            } // if
+        } // for
 
-        if (!ctx->halt && ctx->tpackets && (ctx->current_seek_generation == ctx->seek_generation))
+        if (best == NULL)  // nothing to do until someone takes a frame, seeks, etc.
         {
-            // Theora, according to example_player.c, is
-            //  "one [packet] in, one [frame] out."
-            if (ogg_stream_packetout(&ctx->tstream, &ctx->packet) <= 0)
-                need_pages = 1;
-            else
-            {
-                // you have to guide the Theora decoder to get meaningful timestamps, apparently.  :/
-                if (ctx->packet.granulepos >= 0)
-                    th_decode_ctl(ctx->tdec, TH_DECCTL_SET_GRANPOS, &ctx->packet.granulepos, sizeof (ctx->packet.granulepos));
+            Mutex_Unlock(sched->lock);
+            Semaphore_Wait(sched->wake);
+            Mutex_Lock(sched->lock);
+            continue;
+        } // if
 
-                if (th_decode_packetin(ctx->tdec, &ctx->packet, &ctx->granulepos) == 0)  // new frame!
-                {
-                    const double videotime = th_granule_time(ctx->tdec, ctx->granulepos);
-                    const unsigned int playms = (unsigned int) (videotime * 1000.0);
+        // one frame at a time, so everyone gets a turn.
+        best->sched_busy = 1;
+        Mutex_Unlock(sched->lock);
+        PumpDecoder(best, 1);
+        Mutex_Lock(sched->lock);
+        best->sched_busy = 0;
 
-                    if (ctx->need_keyframe && th_packet_iskeyframe(&ctx->packet))
-                        ctx->need_keyframe = 0;
+        if (best->sched_waiting)  // stopDecode already took it off the list.
+            Semaphore_Post(best->schedidle);
+        else if (best->sched_next != NULL)  // move to the back, so ties go round-robin.
+        {
+            TheoraDecoder **prev = &sched->decoders;
+            while (*prev != best)
+                prev = &(*prev)->sched_next;
+            *prev = best->sched_next;
+            while (*prev != NULL)
+                prev = &(*prev)->sched_next;
+            *prev = best;
+            best->sched_next = NULL;
+        } // else if
+    } // while
+    Mutex_Unlock(sched->lock);
 
-                    if (ctx->resolving_video_seek && !ctx->need_keyframe && ((playms >= ctx->seek_target) || ((ctx->seek_target - playms) <= (unsigned long) (1000.0 / ctx->fps))))
-                        ctx->resolving_video_seek = 0;
+    return NULL;
+} // SchedulerThread
 
-                    if (!ctx->resolving_video_seek)
-                    {
-                        th_ycbcr_buffer ycbcr;
-                        if (th_decode_ycbcr_out(ctx->tdec, ycbcr) == 0)
-                        {
-                            VideoFrame *item = (VideoFrame *) ctx->allocator.allocate(&ctx->allocator, sizeof (VideoFrame));
-                            if (item == NULL) goto cleanup;
-                            item->seek_generation = ctx->current_seek_generation;
-                            item->playms = playms;
-                            item->fps = ctx->fps;
-                            item->width = ctx->tinfo.pic_width;
-                            item->height = ctx->tinfo.pic_height;
-                            item->format = ctx->vidfmt;
-                            item->pixels = ctx->vidcvt(&ctx->allocator, &ctx->tinfo, ycbcr);
-                            item->next = NULL;
-
-                            if (item->pixels == NULL)
-                            {
-                                free(item);
-                                goto cleanup;
-                            } // if
+static int AttachToScheduler(TheoraDecoder *ctx, THEORAPLAY_Scheduler *sched)
+{
+    TheoraDecoder **prev;
+
+    ctx->schedidle = Semaphore_Create(&ctx->allocator);
+    if (!ctx->schedidle)
+        return 0;
+
+    ctx->scheduler = sched;
+    ctx->wakeworker = sched->wake;  // so getVideo and seek wake the scheduler instead.
+
+    Mutex_Lock(sched->lock);
+    for (prev = &sched->decoders; *prev != NULL; prev = &(*prev)->sched_next) { /* spin to the end. */ }
+    ctx->sched_next = NULL;
+    *prev = ctx;
+    Mutex_Unlock(sched->lock);
+
+    Semaphore_Post(sched->wake);
+    return 1;
+} // AttachToScheduler
+
+// Once this returns, no scheduler thread will touch ctx again.
+static void DetachFromScheduler(TheoraDecoder *ctx)
+{
+    THEORAPLAY_Scheduler *sched = ctx->scheduler;
+    TheoraDecoder **prev;
+    int busy;
+
+    if (!sched)
+        return;
+
+    Mutex_Lock(sched->lock);
+    for (prev = &sched->decoders; *prev != NULL; prev = &(*prev)->sched_next)
+    {
+        if (*prev == ctx)
+        {
+            *prev = ctx->sched_next;
+            break;
+        } // if
+    } // for
+    busy = ctx->sched_busy;
+    ctx->sched_waiting = busy;
+    Mutex_Unlock(sched->lock);
+
+    if (busy)
+        Semaphore_Wait(ctx->schedidle);
+
+    Semaphore_Destroy(&ctx->allocator, ctx->schedidle);
+    ctx->schedidle = NULL;
+    ctx->wakeworker = NULL;  // that was the scheduler's; don't destroy it.
+    ctx->scheduler = NULL;
+} // DetachFromScheduler
+
+#ifndef THEORAPLAY_NO_MALLOC_FALLBACK
+static void *malloc_fallback_allocate(const THEORAPLAY_Allocator *allocator, unsigned int len) { return malloc((size_t) len); }
+static void malloc_fallback_deallocate(const THEORAPLAY_Allocator *allocator, void *ptr) { free(ptr); }
+#endif
+
+#ifndef THEORAPLAY_NO_FOPEN_FALLBACK
+// plain fseek() and ftell() stop at 2 gigabytes wherever long is 32 bits.
+#ifdef _WIN32
+#define THEORAPLAY_FSEEK _fseeki64
+#define THEORAPLAY_FTELL _ftelli64
+#else
+#define THEORAPLAY_FSEEK fseeko
+#define THEORAPLAY_FTELL ftello
+#endif
+
+typedef struct THEORAPLAY_IoUserData
+{
+    FILE *f;
+    THEORAPLAY_Allocator allocator;
+} THEORAPLAY_IoUserData;
+
+static long IoFopenRead(THEORAPLAY_Io64 *io, void *buf, long buflen)
+{
+    FILE *f = ((THEORAPLAY_IoUserData *) io->userdata)->f;
+    const size_t br = fread(buf, 1, buflen, f);
+    if ((br == 0) && ferror(f))
+        return -1;
+    return (long) br;
+} // IoFopenRead
+
+static long long IoFopenStreamLen(THEORAPLAY_Io64 *io)
+{
+    FILE *f = ((THEORAPLAY_IoUserData *) io->userdata)->f;
+    const long long origpos = (long long) THEORAPLAY_FTELL(f);
+    long long retval = -1;
+    if (THEORAPLAY_FSEEK(f, 0, SEEK_END) == 0) {
+        retval = (long long) THEORAPLAY_FTELL(f);
+    }
+    THEORAPLAY_FSEEK(f, origpos, SEEK_SET);
+    return retval;
+} // IoFopenStreamLen
+
+static int IoFopenSeek(THEORAPLAY_Io64 *io, long long absolute_offset)
+{
+    FILE *f = ((THEORAPLAY_IoUserData *) io->userdata)->f;
+    return THEORAPLAY_FSEEK(f, absolute_offset, SEEK_SET);
+} // IoFopenSeek
+
+static void IoFopenClose(THEORAPLAY_Io64 *io)
+{
+    THEORAPLAY_IoUserData *userdata = (THEORAPLAY_IoUserData *) io->userdata;
+    THEORAPLAY_Allocator allocator;  // userdata lives in the block we're freeing.
+    memcpy(&allocator, &userdata->allocator, sizeof (THEORAPLAY_Allocator));
+    fclose(userdata->f);
+    allocator.deallocate(&allocator, io);
+} // IoFopenClose
+
+static THEORAPLAY_Io64 *IoFopenOpen(const char *fname, const THEORAPLAY_Allocator *allocator)
+{
+    THEORAPLAY_Io64 *io = (THEORAPLAY_Io64 *) allocator->allocate(allocator, sizeof (THEORAPLAY_Io64) + sizeof (THEORAPLAY_IoUserData));
+    if (io == NULL)
+        return NULL;
+
+    THEORAPLAY_IoUserData *userdata = (THEORAPLAY_IoUserData *) (io + 1);  /* we allocated it right after the Io interface */
+
+    memcpy(&userdata->allocator, allocator, sizeof (THEORAPLAY_Allocator));
+
+    userdata->f = fopen(fname, "rb");
+    if (userdata->f == NULL)
+    {
+        allocator->deallocate(allocator, io);
+        return NULL;
+    } // if
+
+    io->read = IoFopenRead;
+    io->seek = IoFopenSeek;
+    io->streamlen = IoFopenStreamLen;
+    io->close = IoFopenClose;
+    io->userdata = userdata;
+    return io;
+} // IoFopenOpen
+#endif
+
+// An Io over a stream that's already in memory: an app's buffer, or a file
+//  we mapped. The decoder recognizes these and parses pages straight out of
+//  the memory instead of reading through the Io.
+typedef struct THEORAPLAY_MemoryIoUserData
+{
+    const unsigned char *data;
+    long long len;
+    long long pos;
+    int mapped;  // non-zero if we mmap()'d data, and have to unmap it.
+    THEORAPLAY_Allocator allocator;
+} THEORAPLAY_MemoryIoUserData;
+
+static long IoMemoryRead(THEORAPLAY_Io64 *io, void *buf, long buflen)
+{
+    THEORAPLAY_MemoryIoUserData *userdata = (THEORAPLAY_MemoryIoUserData *) io->userdata;
+    const long long avail = userdata->len - userdata->pos;
+    if (buflen > avail)
+        buflen = (long) avail;
+    memcpy(buf, userdata->data + userdata->pos, (size_t) buflen);
+    userdata->pos += buflen;
+    return buflen;
+} // IoMemoryRead
+
+static long long IoMemoryStreamLen(THEORAPLAY_Io64 *io)
+{
+    return ((THEORAPLAY_MemoryIoUserData *) io->userdata)->len;
+} // IoMemoryStreamLen
+
+static int IoMemorySeek(THEORAPLAY_Io64 *io, long long absolute_offset)
+{
+    THEORAPLAY_MemoryIoUserData *userdata = (THEORAPLAY_MemoryIoUserData *) io->userdata;
+    if ((absolute_offset < 0) || (absolute_offset > userdata->len))
+        return -1;
+    userdata->pos = absolute_offset;
+    return 0;
+} // IoMemorySeek
+
+static void IoMemoryClose(THEORAPLAY_Io64 *io)
+{
+    THEORAPLAY_MemoryIoUserData *userdata = (THEORAPLAY_MemoryIoUserData *) io->userdata;
+    THEORAPLAY_Allocator allocator;  // userdata lives in the block we're freeing.
+    memcpy(&allocator, &userdata->allocator, sizeof (THEORAPLAY_Allocator));
+    #ifdef THEORAPLAY_HAVE_MMAP
+    if (userdata->mapped)
+        munmap((void *) userdata->data, (size_t) userdata->len);
+    #endif
+    allocator.deallocate(&allocator, io);
+} // IoMemoryClose
+
+static THEORAPLAY_Io64 *IoMemoryOpen(const void *data, const long long len, const int mapped, const THEORAPLAY_Allocator *allocator)
+{
+    THEORAPLAY_Io64 *io = (THEORAPLAY_Io64 *) allocator->allocate(allocator, sizeof (THEORAPLAY_Io64) + sizeof (THEORAPLAY_MemoryIoUserData));
+    THEORAPLAY_MemoryIoUserData *userdata;
+    if (io == NULL)
+        return NULL;
+
+    userdata = (THEORAPLAY_MemoryIoUserData *) (io + 1);  /* we allocated it right after the Io interface */
+    memcpy(&userdata->allocator, allocator, sizeof (THEORAPLAY_Allocator));
+    userdata->data = (const unsigned char *) data;
+    userdata->len = len;
+    userdata->pos = 0;
+    userdata->mapped = mapped;
+
+    io->read = IoMemoryRead;
+    io->seek = IoMemorySeek;
+    io->streamlen = IoMemoryStreamLen;
+    io->close = IoMemoryClose;
+    io->userdata = userdata;
+    return io;
+} // IoMemoryOpen
+
+THEORAPLAY_Io64 *THEORAPLAY_createMemoryIo(const void *buf, const size_t len, const THEORAPLAY_Allocator *allocator)
+{
+    #ifdef THEORAPLAY_NO_MALLOC_FALLBACK
+    if (allocator == NULL) {
+        return NULL;
+    }
+    #else
+    THEORAPLAY_Allocator malloc_fallback_allocator;
+    if (allocator == NULL) {
+        malloc_fallback_allocator.allocate = malloc_fallback_allocate;
+        malloc_fallback_allocator.deallocate = malloc_fallback_deallocate;
+        malloc_fallback_allocator.userdata = NULL;
+        allocator = &malloc_fallback_allocator;
+    }
+    #endif
+
+    if ((buf == NULL) || (len == 0) || (((unsigned long long) len) > (unsigned long long) LLONG_MAX))
+        return NULL;
+
+    return IoMemoryOpen(buf, (long long) len, 0, allocator);
+} // THEORAPLAY_createMemoryIo
+
+THEORAPLAY_Io64 *THEORAPLAY_createMmapIo(const char *fname, const THEORAPLAY_Allocator *allocator)
+{
+#ifndef THEORAPLAY_HAVE_MMAP
+    return NULL;
+#else
+    THEORAPLAY_Io64 *io;
+    struct stat statbuf;
+    void *data;
+    int fd;
+
+    #ifdef THEORAPLAY_NO_MALLOC_FALLBACK
+    if (allocator == NULL) {
+        return NULL;
+    }
+    #else
+    THEORAPLAY_Allocator malloc_fallback_allocator;
+    if (allocator == NULL) {
+        malloc_fallback_allocator.allocate = malloc_fallback_allocate;
+        malloc_fallback_allocator.deallocate = malloc_fallback_deallocate;
+        malloc_fallback_allocator.userdata = NULL;
+        allocator = &malloc_fallback_allocator;
+    }
+    #endif
+
+    fd = open(fname, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    // can't map an empty file, or one bigger than our address space.
+    if ((fstat(fd, &statbuf) == -1) || (statbuf.st_size <= 0) || (((unsigned long long) statbuf.st_size) > (unsigned long long) (((size_t) -1) / 2)))
+    {
+        close(fd);
+        return NULL;
+    } // if
+
+    data = mmap(NULL, (size_t) statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // the mapping keeps the file alive.
+    if (data == MAP_FAILED)
+        return NULL;
+
+    io = IoMemoryOpen(data, (long long) statbuf.st_size, 1, allocator);
+    if (io == NULL)
+    {
+        munmap(data, (size_t) statbuf.st_size);
+        return NULL;
+    } // if
+
+    madvise(data, (size_t) statbuf.st_size, MADV_SEQUENTIAL);
+    return io;
+#endif
+} // THEORAPLAY_createMmapIo
+
+// The read-ahead stage: an Io that wraps the app's Io, with a thread that
+//  keeps a ring buffer topped up from it, so a slow read overlaps decoding
+//  instead of stalling it. Only the reader thread reads the app's Io, and
+//  it holds iolock while it does; seeks take iolock too, so they wait for
+//  an outstanding read and then throw the buffer away.
+typedef struct ReadAhead
+{
+    THEORAPLAY_Allocator allocator;
+    THEORAPLAY_Io64 *io;  // the app's Io. Only touched with iolock held.
+    THEORAPLAY_MUTEX_T iolock;
+    THEORAPLAY_MUTEX_T lock;  // guards everything below.
+    THEORAPLAY_SEM_T wakereader;  // the reader thread sleeps on this while the ring is full.
+    THEORAPLAY_SEM_T dataready;  // the decoder sleeps on this while the ring is empty.
+    THEORAPLAY_THREAD_T thread;
+    unsigned char *ring;
+    long ringlen;
+    long chunk;  // most we read at once; the reader waits until there's this much room.
+    long head;  // where the decoder reads next.
+    long count;  // bytes waiting in the ring.
+    long long pos;  // stream offset of head.
+    int reader_waiting;
+    int decoder_waiting;
+    int seeking;  // the decoder wants iolock; don't grab it again.
+    int eof;  // 1 at end of stream, -1 on i/o error.
+    int halt;
+} ReadAhead;
+
+static void *ReadAheadThread(void *_this)
+{
+    ReadAhead *ra = (ReadAhead *) _this;
+
+    while (1)
+    {
+        long tail, len, br;
+
+        Mutex_Lock(ra->iolock);
+        Mutex_Lock(ra->lock);
+        if (ra->halt)
+        {
+            Mutex_Unlock(ra->lock);
+            Mutex_Unlock(ra->iolock);
+            break;
+        } // if
+        else if (ra->seeking || ra->eof || ((ra->ringlen - ra->count) < ra->chunk))
+        {
+            ra->reader_waiting = 1;
+            Mutex_Unlock(ra->lock);
+            Mutex_Unlock(ra->iolock);
+            Semaphore_Wait(ra->wakereader);
+            continue;
+        } // else if
+
+        // the decoder only reads what's counted, so we can fill the rest
+        //  without the lock. Don't wrap around in one read.
+        tail = (ra->head + ra->count) % ra->ringlen;
+        len = ra->ringlen - tail;
+        if (len > ra->chunk)
+            len = ra->chunk;
+        Mutex_Unlock(ra->lock);
+
+        br = ra->io->read(ra->io, ra->ring + tail, len);
+
+        Mutex_Lock(ra->lock);
+        if (br > 0)
+            ra->count += br;
+        else
+            ra->eof = (br == 0) ? 1 : -1;
+
+        if (ra->decoder_waiting)
+        {
+            ra->decoder_waiting = 0;
+            Semaphore_Post(ra->dataready);
+        } // if
+        Mutex_Unlock(ra->lock);
+        Mutex_Unlock(ra->iolock);
+    } // while
+
+    return NULL;
+} // ReadAheadThread
+
+static long ReadAheadRead(THEORAPLAY_Io64 *io, void *buf, long buflen)
+{
+    ReadAhead *ra = (ReadAhead *) io->userdata;
+    unsigned char *dst = (unsigned char *) buf;
+    long retval;
+
+    Mutex_Lock(ra->lock);
+    while ((ra->count == 0) && !ra->eof)
+    {
+        ra->decoder_waiting = 1;
+        Mutex_Unlock(ra->lock);
+        Semaphore_Wait(ra->dataready);
+        Mutex_Lock(ra->lock);
+    } // while
+
+    if (ra->count == 0)
+        retval = (ra->eof < 0) ? -1 : 0;
+    else
+    {
+        const long first = ra->ringlen - ra->head;
+        retval = (buflen < ra->count) ? buflen : ra->count;
+        if (retval <= first)
+            memcpy(dst, ra->ring + ra->head, (size_t) retval);
+        else
+        {
+            memcpy(dst, ra->ring + ra->head, (size_t) first);
+            memcpy(dst + first, ra->ring, (size_t) (retval - first));
+        } // else
+
+        ra->head = (ra->head + retval) % ra->ringlen;
+        ra->count -= retval;
+        ra->pos += retval;
+
+        if (ra->reader_waiting && ((ra->ringlen - ra->count) >= ra->chunk))
+        {
+            ra->reader_waiting = 0;
+            Semaphore_Post(ra->wakereader);
+        } // if
+    } // else
+    Mutex_Unlock(ra->lock);
+
+    return retval;
+} // ReadAheadRead
+
+static long long ReadAheadStreamLen(THEORAPLAY_Io64 *io)
+{
+    ReadAhead *ra = (ReadAhead *) io->userdata;
+    long long retval;
+    Mutex_Lock(ra->iolock);
+    retval = ra->io->streamlen(ra->io);
+    Mutex_Unlock(ra->iolock);
+    return retval;
+} // ReadAheadStreamLen
+
+static int ReadAheadSeek(THEORAPLAY_Io64 *io, long long absolute_offset)
+{
+    ReadAhead *ra = (ReadAhead *) io->userdata;
+    int retval = 0;
+
+    Mutex_Lock(ra->lock);
+    if ((absolute_offset >= ra->pos) && (absolute_offset < (ra->pos + ra->count)))
+    {
+        // already buffered; just skip ahead to it.
+        const long skip = (long) (absolute_offset - ra->pos);
+        ra->head = (ra->head + skip) % ra->ringlen;
+        ra->count -= skip;
+        ra->pos = absolute_offset;
+        Mutex_Unlock(ra->lock);
+        return 0;
+    } // if
+    ra->seeking = 1;
+    Mutex_Unlock(ra->lock);
+
+    Mutex_Lock(ra->iolock);  // wait for any read in progress to finish.
+    retval = ra->io->seek(ra->io, absolute_offset);
+    Mutex_Lock(ra->lock);
+    ra->seeking = 0;
+    ra->head = ra->count = 0;
+    ra->pos = absolute_offset;
+    ra->eof = (retval == -1) ? -1 : 0;
+    if (ra->reader_waiting)
+    {
+        ra->reader_waiting = 0;
+        Semaphore_Post(ra->wakereader);
+    } // if
+    Mutex_Unlock(ra->lock);
+    Mutex_Unlock(ra->iolock);
 
-                            //printf("Decoded another video frame.\n");
-                            Mutex_Lock(ctx->lock);
-                            if (ctx->videolisttail)
-                            {
-                                assert(ctx->videolist);
-                                ctx->videolisttail->next = item;
-                            } // if
-                            else
-                            {
-                                assert(!ctx->videolist);
-                                ctx->videolist = item;
-                            } // else
-                            ctx->videolisttail = item;
-                            ctx->videocount++;
+    return retval;
+} // ReadAheadSeek
 
-                            desired_frames--;
+// Everything but the app's Io, which the caller deals with.
+static void ReadAheadFree(THEORAPLAY_Io64 *io)
+{
+    ReadAhead *ra = (ReadAhead *) io->userdata;
+    THEORAPLAY_Allocator allocator;  // ra lives in the block we're freeing.
+    memcpy(&allocator, &ra->allocator, sizeof (THEORAPLAY_Allocator));
+    allocator.deallocate(&allocator, ra->ring);
+    Semaphore_Destroy(&allocator, ra->wakereader);
+    Semaphore_Destroy(&allocator, ra->dataready);
+    if (ra->lock)
+        Mutex_Destroy(&allocator, ra->lock);
+    if (ra->iolock)
+        Mutex_Destroy(&allocator, ra->iolock);
+    allocator.deallocate(&allocator, io);
+} // ReadAheadFree
+
+static void ReadAheadClose(THEORAPLAY_Io64 *io)
+{
+    ReadAhead *ra = (ReadAhead *) io->userdata;
+    THEORAPLAY_Io64 *appio = ra->io;
 
-                            // if we're full, consider this a full pump.
-                            if (ctx->videocount >= ctx->maxframes)
-                                desired_frames = 0;
-                            Mutex_Unlock(ctx->lock);
+    Mutex_Lock(ra->lock);
+    ra->halt = 1;
+    if (ra->reader_waiting)
+    {
+        ra->reader_waiting = 0;
+        Semaphore_Post(ra->wakereader);
+    } // if
+    Mutex_Unlock(ra->lock);
+    Thread_Join(ra->thread);
 
-                            had_new_video_frames = 1;
-                        } // if
-                    } // if
-                } // if
-            } // else
-        } // if
+    ReadAheadFree(io);
+    appio->close(appio);
+} // ReadAheadClose
 
-        if (!ctx->halt && need_pages && (ctx->current_seek_generation == ctx->seek_generation))
-        {
-            const int rc = FeedMoreOggData(ctx->io, &ctx->sync);
-            if (rc == 0)
-                ctx->eos = 1;  // end of stream
-            else if (rc < 0)
-                goto cleanup;  // i/o error, etc.
-            else
-            {
-                while (!ctx->halt && (ogg_sync_pageout(&ctx->sync, &ctx->page) > 0))
-                    QueueOggPage(ctx);
-            } // else
-        } // if
-    } // while
+// Wraps appio in a read-ahead stage buffering ringlen bytes. Returns NULL if
+//  that fails, in which case the decoder should just use appio directly.
+static THEORAPLAY_Io64 *ReadAheadOpen(THEORAPLAY_Io64 *appio, long ringlen, const THEORAPLAY_Allocator *allocator)
+{
+    THEORAPLAY_Io64 *io;
+    ReadAhead *ra;
 
-    ctx->was_error = 0;
+    if (THEORAPLAY_ONLY_SINGLE_THREADED)
+        return NULL;
 
-cleanup:
-    ctx->decode_error = (!ctx->halt && ctx->was_error);
-    ctx->thread_done = (ctx->halt || ctx->eos || ctx->decode_error);
+    if (ringlen < READAHEAD_MIN)
+        ringlen = READAHEAD_MIN;
 
-    return had_new_video_frames;
-} // PumpDecoder
+    io = (THEORAPLAY_Io64 *) allocator->allocate(allocator, sizeof (THEORAPLAY_Io64) + sizeof (ReadAhead));
+    if (io == NULL)
+        return NULL;
 
+    ra = (ReadAhead *) (io + 1);  /* we allocated it right after the Io interface */
+    memset(ra, '\0', sizeof (ReadAhead));
+    memcpy(&ra->allocator, allocator, sizeof (THEORAPLAY_Allocator));
+    ra->io = appio;
+    ra->ringlen = ringlen;
+    ra->chunk = ringlen / 4;
+    ra->pos = 0;  // the decoder assumes a fresh Io starts at the beginning, too.
+
+    io->read = ReadAheadRead;
+    io->seek = appio->seek ? ReadAheadSeek : NULL;
+    io->streamlen = appio->streamlen ? ReadAheadStreamLen : NULL;
+    io->close = ReadAheadClose;
+    io->userdata = ra;
+
+    ra->ring = (unsigned char *) allocator->allocate(allocator, (unsigned int) ringlen);
+    ra->lock = Mutex_Create(allocator);
+    ra->iolock = Mutex_Create(allocator);
+    ra->wakereader = Semaphore_Create(allocator);
+    ra->dataready = Semaphore_Create(allocator);
+    if (!ra->ring || !ra->lock || !ra->iolock || !ra->wakereader || !ra->dataready)
+    {
+        ReadAheadFree(io);
+        return NULL;
+    } // if
 
-static void *WorkerThread(void *_this)
-{
-#if !THEORAPLAY_ONLY_SINGLE_THREADED
-    TheoraDecoder *ctx = (TheoraDecoder *) _this;
-    while (!ctx->thread_done)
+    if (Thread_Create(&ra->thread, ReadAheadThread, ra) != 0)
     {
-        const int had_new_video_frames = PumpDecoder(ctx, ctx->maxframes);
-        // Sleep the process until we have space for more frames.
-        if (had_new_video_frames && !ctx->thread_done)
-        {
-            int go_on = !ctx->halt;
-            //printf("Sleeping.\n");
-            while (go_on)
-            {
-                // !!! FIXME: This is stupid. I should use a semaphore for this.
-                Mutex_Lock(ctx->lock);
-                go_on = !ctx->halt && (ctx->videocount >= ctx->maxframes);
-                Mutex_Unlock(ctx->lock);
-                if (go_on)
-                    sleepms(10);
-            } // while
-            //printf("Awake!\n");
-        } // if
-    }
+        ReadAheadFree(io);
+        return NULL;
+    } // if
 
-    //printf("Worker thread is done.\n");
-#endif
-    return NULL;
-} // WorkerThread
+    return io;
+} // ReadAheadOpen
 
-#ifndef THEORAPLAY_NO_FOPEN_FALLBACK
-typedef struct THEORAPLAY_IoUserData
+// Lets the decoder treat an app's THEORAPLAY_Io like any other Io64.
+typedef struct IoLegacyUserData
 {
-    FILE *f;
+    THEORAPLAY_Io *io;
     THEORAPLAY_Allocator allocator;
-} THEORAPLAY_IoUserData;
+} IoLegacyUserData;
 
-static long IoFopenRead(THEORAPLAY_Io *io, void *buf, long buflen)
+static long IoLegacyRead(THEORAPLAY_Io64 *io, void *buf, long buflen)
 {
-    FILE *f = ((THEORAPLAY_IoUserData *) io->userdata)->f;
-    const size_t br = fread(buf, 1, buflen, f);
-    if ((br == 0) && ferror(f))
-        return -1;
-    return (long) br;
-} // IoFopenRead
+    THEORAPLAY_Io *appio = ((IoLegacyUserData *) io->userdata)->io;
+    return appio->read(appio, buf, buflen);
+} // IoLegacyRead
 
-static long IoFopenStreamLen(THEORAPLAY_Io *io)
+static long long IoLegacyStreamLen(THEORAPLAY_Io64 *io)
 {
-    FILE *f = ((THEORAPLAY_IoUserData *) io->userdata)->f;
-    const long origpos = ftell(f);
-    long retval = -1;
-    if (fseek(f, 0, SEEK_END) == 0) {
-        retval = ftell(f);
-    }
-    fseek(f, origpos, SEEK_SET);
-    return retval;
-} // IoFopenStreamLen
+    THEORAPLAY_Io *appio = ((IoLegacyUserData *) io->userdata)->io;
+    return (long long) appio->streamlen(appio);
+} // IoLegacyStreamLen
 
-static int IoFopenSeek(THEORAPLAY_Io *io, long absolute_offset)
+static int IoLegacySeek(THEORAPLAY_Io64 *io, long long absolute_offset)
 {
-    FILE *f = ((THEORAPLAY_IoUserData *) io->userdata)->f;
-    return fseek(f, absolute_offset, SEEK_SET);
-} // IoFopenSeek
+    THEORAPLAY_Io *appio = ((IoLegacyUserData *) io->userdata)->io;
+    if ((absolute_offset < 0) || (absolute_offset > LONG_MAX))
+        return -1;  // can't get there from here.
+    return appio->seek(appio, (long) absolute_offset);
+} // IoLegacySeek
 
-static void IoFopenClose(THEORAPLAY_Io *io)
+static void IoLegacyClose(THEORAPLAY_Io64 *io)
 {
-    THEORAPLAY_IoUserData *userdata = (THEORAPLAY_IoUserData *) io->userdata;
-    fclose(userdata->f);
-    userdata->allocator.deallocate(&userdata->allocator, io);
-} // IoFopenClose
-#endif
+    IoLegacyUserData *userdata = (IoLegacyUserData *) io->userdata;
+    THEORAPLAY_Io *appio = userdata->io;
+    THEORAPLAY_Allocator allocator;  // userdata lives in the block we're freeing.
+    memcpy(&allocator, &userdata->allocator, sizeof (THEORAPLAY_Allocator));
+    allocator.deallocate(&allocator, io);
+    appio->close(appio);
+} // IoLegacyClose
+
+// Closes appio if this fails, since whatever it was handed to would have.
+static THEORAPLAY_Io64 *IoLegacyOpen(THEORAPLAY_Io *appio, const THEORAPLAY_Allocator *allocator)
+{
+    THEORAPLAY_Io64 *io = (THEORAPLAY_Io64 *) allocator->allocate(allocator, sizeof (THEORAPLAY_Io64) + sizeof (IoLegacyUserData));
+    IoLegacyUserData *userdata;
 
-#ifndef THEORAPLAY_NO_MALLOC_FALLBACK
-static void *malloc_fallback_allocate(const THEORAPLAY_Allocator *allocator, unsigned int len) { return malloc((size_t) len); }
-static void malloc_fallback_deallocate(const THEORAPLAY_Allocator *allocator, void *ptr) { free(ptr); }
-#endif
+    if (io == NULL)
+    {
+        appio->close(appio);
+        return NULL;
+    } // if
+
+    userdata = (IoLegacyUserData *) (io + 1);  /* we allocated it right after the Io interface */
+    memcpy(&userdata->allocator, allocator, sizeof (THEORAPLAY_Allocator));
+    userdata->io = appio;
+
+    io->read = IoLegacyRead;
+    io->seek = appio->seek ? IoLegacySeek : NULL;
+    io->streamlen = appio->streamlen ? IoLegacyStreamLen : NULL;
+    io->close = IoLegacyClose;
+    io->userdata = userdata;
+    return io;
+} // IoLegacyOpen
 
 THEORAPLAY_Decoder *THEORAPLAY_startDecodeFile(const char *fname,
                                                const unsigned int maxframes,
                                                THEORAPLAY_VideoFormat vidfmt,
                                                const THEORAPLAY_Allocator *allocator,
                                                const int multithreaded)
+{
+    return THEORAPLAY_startDecodeFileEx(fname, maxframes, vidfmt, allocator, multithreaded, NULL);
+} // THEORAPLAY_startDecodeFile
+
+
+THEORAPLAY_Decoder *THEORAPLAY_startDecodeFileEx(const char *fname,
+                                                 const unsigned int maxframes,
+                                                 THEORAPLAY_VideoFormat vidfmt,
+                                                 const THEORAPLAY_Allocator *allocator,
+                                                 const int multithreaded,
+                                                 const THEORAPLAY_DecoderOptions *options)
 {
 #ifdef THEORAPLAY_NO_FOPEN_FALLBACK
     return NULL;
 #else
-    THEORAPLAY_Io *io;
+    THEORAPLAY_Io64 *io;
 
     #ifdef THEORAPLAY_NO_MALLOC_FALLBACK
     if (allocator == NULL) {
@@ -946,30 +4089,44 @@ THEORAPLAY_Decoder *THEORAPLAY_startDecodeFile(const char *fname,
     }
     #endif
 
-    io = (THEORAPLAY_Io *) allocator->allocate(allocator, sizeof (THEORAPLAY_Io) + sizeof (THEORAPLAY_IoUserData));
+    io = IoFopenOpen(fname, allocator);
     if (io == NULL)
         return NULL;
 
-    THEORAPLAY_IoUserData *userdata = (THEORAPLAY_IoUserData *) (io + 1);  /* we allocated it right after the Io interface */
+    return THEORAPLAY_startDecodeIo64(io, maxframes, vidfmt, allocator, multithreaded, options);
+#endif
+} // THEORAPLAY_startDecodeFileEx
 
-    memcpy(&userdata->allocator, allocator, sizeof (THEORAPLAY_Allocator));
 
-    userdata->f = fopen(fname, "rb");
-    if (userdata->f == NULL)
-    {
-        allocator->deallocate(allocator, io);
+THEORAPLAY_Decoder *THEORAPLAY_startDecodeMemory(const void *buf, const size_t len,
+                                                 const unsigned int maxframes,
+                                                 THEORAPLAY_VideoFormat vidfmt,
+                                                 const THEORAPLAY_Allocator *allocator,
+                                                 const int multithreaded,
+                                                 const THEORAPLAY_DecoderOptions *options)
+{
+    THEORAPLAY_Io64 *io;
+
+    #ifdef THEORAPLAY_NO_MALLOC_FALLBACK
+    if (allocator == NULL) {
         return NULL;
-    } // if
+    }
+    #else
+    THEORAPLAY_Allocator malloc_fallback_allocator;
+    if (allocator == NULL) {
+        malloc_fallback_allocator.allocate = malloc_fallback_allocate;
+        malloc_fallback_allocator.deallocate = malloc_fallback_deallocate;
+        malloc_fallback_allocator.userdata = NULL;
+        allocator = &malloc_fallback_allocator;
+    }
+    #endif
 
-    io->read = IoFopenRead;
-    io->seek = IoFopenSeek;
-    io->streamlen = IoFopenStreamLen;
-    io->close = IoFopenClose;
-    io->userdata = userdata;
+    io = THEORAPLAY_createMemoryIo(buf, len, allocator);
+    if (io == NULL)
+        return NULL;
 
-    return THEORAPLAY_startDecode(io, maxframes, vidfmt, allocator, multithreaded);
-#endif
-} // THEORAPLAY_startDecodeFile
+    return THEORAPLAY_startDecodeIo64(io, maxframes, vidfmt, allocator, multithreaded, options);
+} // THEORAPLAY_startDecodeMemory
 
 
 THEORAPLAY_Decoder *THEORAPLAY_startDecode(THEORAPLAY_Io *io,
@@ -977,9 +4134,52 @@ THEORAPLAY_Decoder *THEORAPLAY_startDecode(THEORAPLAY_Io *io,
                                            THEORAPLAY_VideoFormat vidfmt,
                                            const THEORAPLAY_Allocator *allocator,
                                            const int multithreaded)
+{
+    return THEORAPLAY_startDecodeEx(io, maxframes, vidfmt, allocator, multithreaded, NULL);
+} // THEORAPLAY_startDecode
+
+
+THEORAPLAY_Decoder *THEORAPLAY_startDecodeEx(THEORAPLAY_Io *io,
+                                             const unsigned int maxframes,
+                                             THEORAPLAY_VideoFormat vidfmt,
+                                             const THEORAPLAY_Allocator *allocator,
+                                             const int multithreaded,
+                                             const THEORAPLAY_DecoderOptions *options)
+{
+    THEORAPLAY_Io64 *io64;
+
+    #ifdef THEORAPLAY_NO_MALLOC_FALLBACK
+    if (allocator == NULL) {
+        return NULL;
+    }
+    #else
+    THEORAPLAY_Allocator malloc_fallback_allocator;
+    if (allocator == NULL) {
+        malloc_fallback_allocator.allocate = malloc_fallback_allocate;
+        malloc_fallback_allocator.deallocate = malloc_fallback_deallocate;
+        malloc_fallback_allocator.userdata = NULL;
+        allocator = &malloc_fallback_allocator;
+    }
+    #endif
+
+    io64 = IoLegacyOpen(io, allocator);
+    if (io64 == NULL)  // this closed io for us.
+        return NULL;
+
+    return THEORAPLAY_startDecodeIo64(io64, maxframes, vidfmt, allocator, multithreaded, options);
+} // THEORAPLAY_startDecodeEx
+
+
+THEORAPLAY_Decoder *THEORAPLAY_startDecodeIo64(THEORAPLAY_Io64 *io,
+                                               const unsigned int maxframes,
+                                               THEORAPLAY_VideoFormat vidfmt,
+                                               const THEORAPLAY_Allocator *allocator,
+                                               const int multithreaded,
+                                               const THEORAPLAY_DecoderOptions *options)
 {
     TheoraDecoder *ctx = NULL;
     ConvertVideoFrameFn vidcvt = NULL;
+    THEORAPLAY_ConvertTier cvttier = THEORAPLAY_CVTTIER_SCALAR;
 
     #ifdef THEORAPLAY_NO_MALLOC_FALLBACK
     if (allocator == NULL) {
@@ -1007,17 +4207,32 @@ THEORAPLAY_Decoder *THEORAPLAY_startDecode(THEORAPLAY_Io *io,
         VIDCVT(YV12)
         VIDCVT(IYUV)
         #undef VIDCVT
+        case THEORAPLAY_VIDFMT_PLANES: break;  // no conversion at all.
 
-        // !!! FIXME: this should actually _check_ for NEON support at runtime (the `&& 1` part).
         #ifdef THEORAPLAY_HAVE_NEON_INTRINSICS
-        #define VIDCVT_NEON(t) if (!vidcvt && 1) { vidcvt = ConvertVideoFrame420To##t##_NEON; }
+        #define VIDCVT_NEON(t) if (!vidcvt && (cvttier == THEORAPLAY_CVTTIER_NEON)) { vidcvt = ConvertVideoFrame420To##t##_NEON; }
         #else
         #define VIDCVT_NEON(t)
         #endif
 
+        #ifdef THEORAPLAY_HAVE_AVX2_INTRINSICS
+        #define VIDCVT_AVX2(t) if (!vidcvt && (cvttier == THEORAPLAY_CVTTIER_AVX2)) { vidcvt = ConvertVideoFrame420To##t##_AVX2; }
+        #else
+        #define VIDCVT_AVX2(t)
+        #endif
+
+        #ifdef THEORAPLAY_HAVE_SSE2_INTRINSICS
+        #define VIDCVT_SSE2(t) if (!vidcvt && (cvttier == THEORAPLAY_CVTTIER_SSE2)) { vidcvt = ConvertVideoFrame420To##t##_SSE2; }
+        #else
+        #define VIDCVT_SSE2(t)
+        #endif
+
         #define VIDCVT(t) case THEORAPLAY_VIDFMT_##t: \
+            cvttier = ChooseConvertTier(); \
             VIDCVT_NEON(t); \
-            if (!vidcvt) { vidcvt = ConvertVideoFrame420To##t; } \
+            VIDCVT_AVX2(t); \
+            VIDCVT_SSE2(t); \
+            if (!vidcvt) { vidcvt = ConvertVideoFrame420To##t; cvttier = THEORAPLAY_CVTTIER_SCALAR; } \
             break;
 
         VIDCVT(RGB)
@@ -1025,6 +4240,9 @@ THEORAPLAY_Decoder *THEORAPLAY_startDecode(THEORAPLAY_Io *io,
         VIDCVT(BGRA)
         VIDCVT(RGB565)
         #undef VIDCVT
+        #undef VIDCVT_NEON
+        #undef VIDCVT_AVX2
+        #undef VIDCVT_SSE2
         default: goto startdecode_failed;  // invalid/unsupported format.
     } // switch
 
@@ -1037,70 +4255,168 @@ THEORAPLAY_Decoder *THEORAPLAY_startDecode(THEORAPLAY_Io *io,
     ctx->maxframes = maxframes;
     ctx->vidfmt = vidfmt;
     ctx->vidcvt = vidcvt;
+    ctx->cvttier = cvttier;
     ctx->io = io;
     ctx->streamlen = -1;
     ctx->was_error = 1;  // resets to 0 at the end.
     ctx->bos = 1;
 
+    if (io->read == IoMemoryRead)  // already in memory? Then skip the Io and parse pages straight out of it.
+    {
+        const THEORAPLAY_MemoryIoUserData *userdata = (const THEORAPLAY_MemoryIoUserData *) io->userdata;
+        ctx->mapdata = userdata->data;
+        ctx->maplen = userdata->len;
+        ctx->mmapped = userdata->mapped;
+    } // if
+
     ogg_sync_init(&ctx->sync);
     vorbis_info_init(&ctx->vinfo);
     vorbis_comment_init(&ctx->vcomment);
     th_comment_init(&ctx->tcomment);
     th_info_init(&ctx->tinfo);
 
+    if (options)
+        memcpy(&ctx->options, options, sizeof (THEORAPLAY_DecoderOptions));
+
+    ctx->readchunk = READ_CHUNK_DEFAULT;
+    ctx->ratepos = -1;
+    ctx->indexprev = SEEKINDEX_TOP;
+    if (ctx->options.read_size == THEORAPLAY_READSIZE_ADAPTIVE)
+        ctx->adaptiveread = 1;
+    else if (ctx->options.read_size > READ_CHUNK_LIMIT)
+        ctx->readchunk = READ_CHUNK_LIMIT;
+    else if (ctx->options.read_size > 0)
+        ctx->readchunk = (long) ctx->options.read_size;
+
+    // seeks can come from the app while the pipeline or worker threads run,
+    //  so we need the lock even if the decoder itself isn't threaded.
+    ctx->lock = Mutex_Create(&ctx->allocator);
+    if (!ctx->lock)
+        goto startdecode_failed;
+
+    ctx->indexlock = Mutex_Create(&ctx->allocator);
+    if (!ctx->indexlock)
+        goto startdecode_failed;
+
+    ctx->framepool = CreateFramePool(&ctx->allocator, maxframes + FRAME_POOL_SLACK);
+    if (!ctx->framepool)
+        goto startdecode_failed;
+
+    // size video blocks so a full queue fits in one; then two blocks cover it forever.
+    if (!InitItemQueue(&ctx->videoqueue, &ctx->allocator, maxframes + FRAME_POOL_SLACK))
+        goto startdecode_failed;
+    else if (!InitItemQueue(&ctx->audioqueue, &ctx->allocator, AUDIO_QUEUE_BLOCK_SLOTS))
+        goto startdecode_failed;
+
+    // THEORAPLAY_VIDFMT_PLANES is just a copy, so there's nothing to farm out.
+    if (vidcvt != NULL)
+    {
+        StartConvertHelpers(ctx, ctx->options.convert_threads);
+        if (ctx->options.pipeline)
+            StartPipeline(ctx);
+    } // if
+
+    // a mapping is already as close to the decoder as data gets.
+    if ((ctx->options.readahead > 0) && (ctx->mapdata == NULL))
+    {
+        THEORAPLAY_Io64 *readahead = ReadAheadOpen(ctx->io, (ctx->options.readahead > 0x7FFFFFFF) ? 0x7FFFFFFF : (long) ctx->options.readahead, &ctx->allocator);
+        if (readahead)  // if this fails, we just read synchronously.
+            ctx->io = readahead;
+    } // if
+
     if (!multithreaded)
         return (THEORAPLAY_Decoder *) ctx;
-    else
+
+    if (ctx->options.scheduler)
     {
-        ctx->lock = Mutex_Create(ctx);
-        if (ctx->lock)
-        {
-            ctx->thread_created = (Thread_Create(ctx, WorkerThread) == 0);
-            if (ctx->thread_created)
-                return (THEORAPLAY_Decoder *) ctx;
-            Mutex_Destroy(ctx, ctx->lock);
-        } // if
-    } // else
+        if (AttachToScheduler(ctx, ctx->options.scheduler))
+            return (THEORAPLAY_Decoder *) ctx;
+        goto startdecode_failed;
+    } // if
+
+    ctx->wakeworker = Semaphore_Create(&ctx->allocator);
+    if (!ctx->wakeworker)
+        goto startdecode_failed;
+
+    ctx->thread_created = (Thread_Create(&ctx->worker, WorkerThread, ctx) == 0);
+    if (ctx->thread_created)
+        return (THEORAPLAY_Decoder *) ctx;
 
 startdecode_failed:
-    if (ctx->lock)
-        Mutex_Destroy(ctx, ctx->lock);
+    if (ctx)
+    {
+        StopPipeline(ctx);
+        StopConvertHelpers(ctx);
+        FreeItemQueue(&ctx->videoqueue);
+        FreeItemQueue(&ctx->audioqueue);
+        DestroyFramePool(ctx->framepool);
+        Semaphore_Destroy(&ctx->allocator, ctx->wakeworker);
+        if (ctx->lock)
+            Mutex_Destroy(&ctx->allocator, ctx->lock);
+        if (ctx->indexlock)
+            Mutex_Destroy(&ctx->allocator, ctx->indexlock);
+        io = ctx->io;  // might be the read-ahead stage, which closes the app's Io for us.
+    } // if
     io->close(io);
     allocator->deallocate(allocator, ctx);
     return NULL;
-} // THEORAPLAY_startDecode
+} // THEORAPLAY_startDecodeIo64
 
 
 void THEORAPLAY_stopDecode(THEORAPLAY_Decoder *decoder)
 {
     TheoraDecoder *ctx = (TheoraDecoder *) decoder;
+    THEORAPLAY_Allocator allocator;
     if (!ctx)
         return;
 
     if (ctx->thread_created)
     {
-        ctx->halt = 1;
+        AtomicSetUInt(&ctx->halt, 1);
+        Semaphore_Post(ctx->wakeworker);
         Thread_Join(ctx->worker);
-        Mutex_Destroy(ctx, ctx->lock);
     } // if
+    else if (ctx->scheduler)
+    {
+        AtomicSetUInt(&ctx->halt, 1);
+        DetachFromScheduler(ctx);
+    } // else if
+    Semaphore_Destroy(&ctx->allocator, ctx->wakeworker);
 
-    VideoFrame *videolist = ctx->videolist;
-    while (videolist)
+    if (ctx->scan_created)
     {
-        VideoFrame *next = videolist->next;
-        free(videolist->pixels);
-        free(videolist);
-        videolist = next;
-    } // while
+        AtomicSetUInt(&ctx->halt, 1);
+        Thread_Join(ctx->scanthread);
+    } // if
 
-    AudioPacket *audiolist = ctx->audiolist;
-    while (audiolist)
+    StopPipeline(ctx);
+    StopConvertHelpers(ctx);
+    Mutex_Destroy(&ctx->allocator, ctx->lock);
+
+    if (ctx->videoqueue.readblock)
     {
-        AudioPacket *next = audiolist->next;
-        free(audiolist->samples);
-        free(audiolist);
-        audiolist = next;
-    } // while
+        VideoFrame *video;
+        while ((video = (VideoFrame *) ItemQueuePop(&ctx->videoqueue)) != NULL)
+            ReleasePooledVideoFrame(video);
+    } // if
+    FreeItemQueue(&ctx->videoqueue);
+
+    DestroyFramePool(ctx->framepool);
+
+    if (ctx->audioqueue.readblock)
+    {
+        AudioPacket *audio;
+        while ((audio = (AudioPacket *) ItemQueuePop(&ctx->audioqueue)) != NULL)
+            FreeAudioPacket(audio);
+    } // if
+    FreeItemQueue(&ctx->audioqueue);
+
+    FreeSeekIndex(&ctx->allocator, &ctx->seekindex);
+    Mutex_Destroy(&ctx->allocator, ctx->indexlock);
+    if (ctx->scalescratch)
+        ctx->allocator.deallocate(&ctx->allocator, ctx->scalescratch);
+    FreeSkeletonIndex(&ctx->allocator, &ctx->tskelindex);
+    FreeSkeletonIndex(&ctx->allocator, &ctx->vskelindex);
 
     if (ctx->tdec != NULL) th_decode_free(ctx->tdec);
     if (ctx->tsetup != NULL) th_setup_free(ctx->tsetup);
@@ -1108,17 +4424,101 @@ void THEORAPLAY_stopDecode(THEORAPLAY_Decoder *decoder)
     if (ctx->vdsp_init) vorbis_dsp_clear(&ctx->vdsp);
     if (ctx->tpackets) ogg_stream_clear(&ctx->tstream);
     if (ctx->vpackets) ogg_stream_clear(&ctx->vstream);
+    if (ctx->skelpackets) ogg_stream_clear(&ctx->skelstream);
     th_info_clear(&ctx->tinfo);
     th_comment_clear(&ctx->tcomment);
     vorbis_comment_clear(&ctx->vcomment);
     vorbis_info_clear(&ctx->vinfo);
     ogg_sync_clear(&ctx->sync);
 
-    if (ctx->io && ctx->io->close)
-        ctx->io->close(ctx->io);
+    if (ctx->io && ctx->io->close)
+        ctx->io->close(ctx->io);
+
+    memcpy(&allocator, &ctx->allocator, sizeof (THEORAPLAY_Allocator));
+    allocator.deallocate(&allocator, ctx);
+} // THEORAPLAY_stopDecode
+
+
+THEORAPLAY_Scheduler *THEORAPLAY_createScheduler(const unsigned int threads,
+                                                 const THEORAPLAY_Allocator *allocator)
+{
+    THEORAPLAY_Scheduler *sched;
+
+    #ifdef THEORAPLAY_NO_MALLOC_FALLBACK
+    if (allocator == NULL) {
+        return NULL;
+    }
+    #else
+    THEORAPLAY_Allocator malloc_fallback_allocator;
+    if (allocator == NULL) {
+        malloc_fallback_allocator.allocate = malloc_fallback_allocate;
+        malloc_fallback_allocator.deallocate = malloc_fallback_deallocate;
+        malloc_fallback_allocator.userdata = NULL;
+        allocator = &malloc_fallback_allocator;
+    }
+    #endif
+
+    if (THEORAPLAY_ONLY_SINGLE_THREADED || (threads == 0))
+        return NULL;
+
+    sched = (THEORAPLAY_Scheduler *) allocator->allocate(allocator, sizeof (THEORAPLAY_Scheduler));
+    if (sched == NULL)
+        return NULL;
+
+    memset(sched, '\0', sizeof (THEORAPLAY_Scheduler));
+    memcpy(&sched->allocator, allocator, sizeof (THEORAPLAY_Allocator));
+    sched->lock = Mutex_Create(&sched->allocator);
+    sched->wake = Semaphore_Create(&sched->allocator);
+    sched->threads = (THEORAPLAY_THREAD_T *) allocator->allocate(allocator, sizeof (THEORAPLAY_THREAD_T) * threads);
+    if (!sched->lock || !sched->wake || !sched->threads)
+    {
+        THEORAPLAY_destroyScheduler(sched);
+        return NULL;
+    } // if
+
+    while (sched->threadcount < threads)
+    {
+        if (Thread_Create(&sched->threads[sched->threadcount], SchedulerThread, sched) != 0)
+        {
+            THEORAPLAY_destroyScheduler(sched);
+            return NULL;
+        } // if
+        sched->threadcount++;
+    } // while
+
+    return sched;
+} // THEORAPLAY_createScheduler
+
+
+void THEORAPLAY_destroyScheduler(THEORAPLAY_Scheduler *sched)
+{
+    THEORAPLAY_Allocator allocator;
+    unsigned int i;
+
+    if (!sched)
+        return;
+
+    assert(sched->decoders == NULL);  // stop the decoders first!
+
+    if (sched->lock)
+    {
+        Mutex_Lock(sched->lock);
+        sched->halt = 1;
+        Mutex_Unlock(sched->lock);
+    } // if
+
+    for (i = 0; i < sched->threadcount; i++)
+        Semaphore_Post(sched->wake);
+    for (i = 0; i < sched->threadcount; i++)
+        Thread_Join(sched->threads[i]);
 
-    free(ctx);
-} // THEORAPLAY_stopDecode
+    memcpy(&allocator, &sched->allocator, sizeof (THEORAPLAY_Allocator));
+    if (sched->threads)
+        allocator.deallocate(&allocator, sched->threads);
+    Semaphore_Destroy(&allocator, sched->wake);
+    Mutex_Destroy(&allocator, sched->lock);
+    allocator.deallocate(&allocator, sched);
+} // THEORAPLAY_destroyScheduler
 
 
 void THEORAPLAY_pumpDecode(THEORAPLAY_Decoder *decoder, const int maxframes)
@@ -1127,12 +4527,10 @@ void THEORAPLAY_pumpDecode(THEORAPLAY_Decoder *decoder, const int maxframes)
 
     if (!ctx)
         return;
-    else if (!ctx->thread_created)
+    else if (!ctx->thread_created && !ctx->scheduler)
     {
-        Mutex_Lock(ctx->lock);
-        if (!ctx->halt && (ctx->videocount >= ctx->maxframes))
+        if (!AtomicGetUInt(&ctx->halt) && VideoQueueFull(ctx))
             return;  // already maxed out on frames, don't do anything this pump.
-        Mutex_Unlock(ctx->lock);
 
         PumpDecoder(ctx, maxframes);
     } // else if
@@ -1144,9 +4542,10 @@ int THEORAPLAY_isDecoding(THEORAPLAY_Decoder *decoder)
     int retval = 0;
     if (ctx)
     {
-        Mutex_Lock(ctx->lock);
-        retval = ( ctx && (ctx->audiolist || ctx->videolist || !ctx->thread_done) );
-        Mutex_Unlock(ctx->lock);
+        // check thread_done first: once it's set, everything the decoder
+        //  queued before that is visible to us.
+        const int done = AtomicGetUInt(&ctx->thread_done);
+        retval = ( !done || AtomicGetUInt(&ctx->audioqueue.count) || AtomicGetUInt(&ctx->videoqueue.count) );
     } // if
     return retval;
 } // THEORAPLAY_isDecoding
@@ -1156,9 +4555,7 @@ int THEORAPLAY_isDecoding(THEORAPLAY_Decoder *decoder)
     TheoraDecoder *ctx = (TheoraDecoder *) decoder; \
     typ retval = defval; \
     if (ctx) { \
-        Mutex_Lock(ctx->lock); \
-        retval = ctx->member; \
-        Mutex_Unlock(ctx->lock); \
+        retval = (typ) AtomicGetUInt(&ctx->member); \
     } \
     return retval;
 
@@ -1182,7 +4579,7 @@ int THEORAPLAY_hasAudioStream(THEORAPLAY_Decoder *decoder)
 
 unsigned int THEORAPLAY_availableVideo(THEORAPLAY_Decoder *decoder)
 {
-    GET_SYNCED_VALUE(unsigned int, 0, decoder, videocount);
+    GET_SYNCED_VALUE(unsigned int, 0, decoder, videoqueue.count);
 } // THEORAPLAY_availableVideo
 
 
@@ -1198,22 +4595,54 @@ int THEORAPLAY_decodingError(THEORAPLAY_Decoder *decoder)
 } // THEORAPLAY_decodingError
 
 
+int THEORAPLAY_isIndexScanning(THEORAPLAY_Decoder *decoder)
+{
+    GET_SYNCED_VALUE(int, 0, decoder, scanning);
+} // THEORAPLAY_isIndexScanning
+
+unsigned int THEORAPLAY_getSeekCatchupFrames(THEORAPLAY_Decoder *decoder)
+{
+    GET_SYNCED_VALUE(unsigned int, 0, decoder, catchup_frames);
+} // THEORAPLAY_getSeekCatchupFrames
+
+unsigned int THEORAPLAY_getDroppedFrames(THEORAPLAY_Decoder *decoder)
+{
+    GET_SYNCED_VALUE(unsigned int, 0, decoder, dropped_frames);
+} // THEORAPLAY_getDroppedFrames
+
+void THEORAPLAY_setPostProcessingLevel(THEORAPLAY_Decoder *decoder, const int level)
+{
+    TheoraDecoder *ctx = (TheoraDecoder *) decoder;
+    if (ctx)
+        AtomicSetUInt(&ctx->pprequest, (level < 0) ? PPLEVEL_ADAPTIVE : (unsigned int) level);
+} // THEORAPLAY_setPostProcessingLevel
+
+int THEORAPLAY_getPostProcessingLevel(THEORAPLAY_Decoder *decoder)
+{
+    GET_SYNCED_VALUE(int, 0, decoder, pplevel_shown);
+} // THEORAPLAY_getPostProcessingLevel
+
+int THEORAPLAY_getMaxPostProcessingLevel(THEORAPLAY_Decoder *decoder)
+{
+    GET_SYNCED_VALUE(int, 0, decoder, pplevel_max);
+} // THEORAPLAY_getMaxPostProcessingLevel
+
+void THEORAPLAY_setPlaybackTime(THEORAPLAY_Decoder *decoder, const unsigned int playms)
+{
+    TheoraDecoder *ctx = (TheoraDecoder *) decoder;
+    if (ctx)
+        AtomicSetUInt(&ctx->playclock, playms + 1);
+} // THEORAPLAY_setPlaybackTime
+
+
 const THEORAPLAY_AudioPacket *THEORAPLAY_getAudio(THEORAPLAY_Decoder *decoder)
 {
     TheoraDecoder *ctx = (TheoraDecoder *) decoder;
     AudioPacket *retval;
 
-    Mutex_Lock(ctx->lock);
-    retval = ctx->audiolist;
+    retval = (AudioPacket *) ItemQueuePop(&ctx->audioqueue);
     if (retval)
-    {
-        ctx->audioms -= retval->playms;
-        ctx->audiolist = retval->next;
-        retval->next = NULL;
-        if (ctx->audiolist == NULL)
-            ctx->audiolisttail = NULL;
-    } // if
-    Mutex_Unlock(ctx->lock);
+        AtomicSubUInt(&ctx->audioms, retval->playms);
 
     return retval;
 } // THEORAPLAY_getAudio
@@ -1225,8 +4654,7 @@ void THEORAPLAY_freeAudio(const THEORAPLAY_AudioPacket *_item)
     if (item != NULL)
     {
         assert(item->next == NULL);
-        free(item->samples);
-        free(item);
+        FreeAudioPacket(item);
     } // if
 } // THEORAPLAY_freeAudio
 
@@ -1236,18 +4664,10 @@ const THEORAPLAY_VideoFrame *THEORAPLAY_getVideo(THEORAPLAY_Decoder *decoder)
     TheoraDecoder *ctx = (TheoraDecoder *) decoder;
     VideoFrame *retval;
 
-    Mutex_Lock(ctx->lock);
-    retval = ctx->videolist;
-    if (retval)
-    {
-        ctx->videolist = retval->next;
-        retval->next = NULL;
-        if (ctx->videolist == NULL)
-            ctx->videolisttail = NULL;
-        assert(ctx->videocount > 0);
-        ctx->videocount--;
-    } // if
-    Mutex_Unlock(ctx->lock);
+    retval = (VideoFrame *) ItemQueuePop(&ctx->videoqueue);
+
+    if (retval && ctx->wakeworker)
+        Semaphore_Post(ctx->wakeworker);  // there's room for another frame now.
 
     return retval;
 } // THEORAPLAY_getVideo
@@ -1259,22 +4679,548 @@ void THEORAPLAY_freeVideo(const THEORAPLAY_VideoFrame *_item)
     if (item != NULL)
     {
         assert(item->next == NULL);
-        free(item->pixels);
-        free(item);
+        ReleasePooledVideoFrame(item);
     } // if
 } // THEORAPLAY_freeVideo
 
 
-unsigned int THEORAPLAY_seek(THEORAPLAY_Decoder *decoder, unsigned long mspos)
+void THEORAPLAY_getFramePoolStats(THEORAPLAY_Decoder *decoder, unsigned long *hits, unsigned long *misses)
+{
+    TheoraDecoder *ctx = (TheoraDecoder *) decoder;
+    unsigned long h = 0, m = 0;
+    if (ctx)
+    {
+        Mutex_Lock(ctx->framepool->lock);
+        h = ctx->framepool->hits;
+        m = ctx->framepool->misses;
+        Mutex_Unlock(ctx->framepool->lock);
+    } // if
+    if (hits) *hits = h;
+    if (misses) *misses = m;
+} // THEORAPLAY_getFramePoolStats
+
+
+void THEORAPLAY_setConvertTier(THEORAPLAY_ConvertTier tier)
+{
+    requested_cvttier = tier;
+} // THEORAPLAY_setConvertTier
+
+
+THEORAPLAY_ConvertTier THEORAPLAY_getConvertTier(THEORAPLAY_Decoder *decoder)
 {
-    unsigned int retval;
     TheoraDecoder *ctx = (TheoraDecoder *) decoder;
+    return ctx ? ctx->cvttier : THEORAPLAY_CVTTIER_AUTO;
+} // THEORAPLAY_getConvertTier
+
+
+static unsigned int RequestSeek(TheoraDecoder *ctx, const unsigned long mspos, const int keyframe_only)
+{
+    unsigned int retval;
     Mutex_Lock(ctx->lock);
     ctx->new_seek_position_ms = mspos;
-    retval = ++ctx->seek_generation;
+    ctx->new_seek_keyframe = keyframe_only;
+    AtomicSetUInt(&ctx->playclock, 0);  // the app's clock is about the old position.
+    retval = AtomicAddUInt(&ctx->seek_generation, 1);
     Mutex_Unlock(ctx->lock);
+    if (ctx->wakeworker)
+        Semaphore_Post(ctx->wakeworker);
     return retval;
+} // RequestSeek
+
+unsigned int THEORAPLAY_seek(THEORAPLAY_Decoder *decoder, unsigned long mspos)
+{
+    return RequestSeek((TheoraDecoder *) decoder, mspos, 0);
 } // THEORAPLAY_seek
 
+unsigned int THEORAPLAY_seekKeyframe(THEORAPLAY_Decoder *decoder, unsigned long mspos)
+{
+    return RequestSeek((TheoraDecoder *) decoder, mspos, 1);
+} // THEORAPLAY_seekKeyframe
+
+
+int THEORAPLAY_startIndexScan(THEORAPLAY_Decoder *decoder, THEORAPLAY_Io *io)
+{
+    TheoraDecoder *ctx = (TheoraDecoder *) decoder;
+    THEORAPLAY_Io64 *io64;
+
+    if (!io)
+        return 0;
+    else if (!ctx)
+    {
+        io->close(io);
+        return 0;
+    } // else if
+
+    io64 = IoLegacyOpen(io, &ctx->allocator);
+    return io64 ? THEORAPLAY_startIndexScanIo64(decoder, io64) : 0;
+} // THEORAPLAY_startIndexScan
+
+
+int THEORAPLAY_startIndexScanIo64(THEORAPLAY_Decoder *decoder, THEORAPLAY_Io64 *io)
+{
+    TheoraDecoder *ctx = (TheoraDecoder *) decoder;
+
+    if (!io)
+        return 0;
+    else if (!ctx || !AtomicGetUInt(&ctx->prepped) || ctx->scan_created)
+    {
+        io->close(io);
+        return 0;
+    } // else if
+
+    ctx->scanio = io;
+    AtomicSetUInt(&ctx->scanning, 1);
+    if (Thread_Create(&ctx->scanthread, IndexScanThread, ctx) != 0)
+    {
+        AtomicSetUInt(&ctx->scanning, 0);
+        ctx->scanio = NULL;
+        io->close(io);
+        return 0;
+    } // if
+
+    ctx->scan_created = 1;
+    return 1;
+} // THEORAPLAY_startIndexScanIo64
+
+
+int THEORAPLAY_startIndexScanFile(THEORAPLAY_Decoder *decoder, const char *fname)
+{
+#ifdef THEORAPLAY_NO_FOPEN_FALLBACK
+    return 0;
+#else
+    TheoraDecoder *ctx = (TheoraDecoder *) decoder;
+    THEORAPLAY_Io64 *io = ctx ? IoFopenOpen(fname, &ctx->allocator) : NULL;
+    return io ? THEORAPLAY_startIndexScanIo64(decoder, io) : 0;
+#endif
+} // THEORAPLAY_startIndexScanFile
+
+
+#ifndef THEORAPLAY_NO_FOPEN_FALLBACK
+// Seek index sidecar files are "TPSI", a version byte, what the index
+//  belongs to (stream length, which streams it has, and their serial
+//  numbers), the entry count, and then each entry as the difference from
+//  the one before it, with the offset's shifted up to make room for the
+//  joined flag in the low bit. Every number is a little-endian base-128
+//  varint, so a typical entry fits in three or four bytes.
+#define SEEKINDEX_FILE_VERSION 2
+
+static int WriteVarint(FILE *f, ogg_uint64_t val)
+{
+    do
+    {
+        const int byte = (int) (val & 0x7F);
+        val >>= 7;
+        if (fputc(val ? (byte | 0x80) : byte, f) == EOF)
+            return 0;
+    } while (val);
+    return 1;
+} // WriteVarint
+
+static int ReadVarint(FILE *f, ogg_uint64_t *_val)
+{
+    ogg_uint64_t val = 0;
+    int shift;
+    for (shift = 0; shift < 64; shift += 7)
+    {
+        const int byte = fgetc(f);
+        if (byte == EOF)
+            return 0;
+        val |= ((ogg_uint64_t) (byte & 0x7F)) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            *_val = val;
+            return 1;
+        } // if
+    } // for
+    return 0;  // corrupt.
+} // ReadVarint
+
+// Granulepos deltas should never go backwards, but we don't trust that.
+static ogg_uint64_t ZigZag(const ogg_int64_t val)
+{
+    return (((ogg_uint64_t) val) << 1) ^ ((val < 0) ? ~((ogg_uint64_t) 0) : 0);
+} // ZigZag
+
+static ogg_int64_t UnZigZag(const ogg_uint64_t val)
+{
+    return (ogg_int64_t) ((val >> 1) ^ ((val & 1) ? ~((ogg_uint64_t) 0) : 0));
+} // UnZigZag
+
+static int WriteSeekIndexHeader(FILE *f, TheoraDecoder *ctx, const unsigned int count)
+{
+    return (fwrite("TPSI", 4, 1, f) == 1) &&
+           (fputc(SEEKINDEX_FILE_VERSION, f) != EOF) &&
+           WriteVarint(f, (ogg_uint64_t) ctx->streamlen) &&
+           WriteVarint(f, (ctx->tpackets ? 1 : 0) | (ctx->vpackets ? 2 : 0)) &&
+           WriteVarint(f, ctx->tpackets ? (ogg_uint64_t) (unsigned int) ctx->tserialno : 0) &&
+           WriteVarint(f, ctx->vpackets ? (ogg_uint64_t) (unsigned int) ctx->vserialno : 0) &&
+           WriteVarint(f, count);
+} // WriteSeekIndexHeader
+
+// Returns the entry count if the file belongs to this stream, -1 otherwise.
+static long ReadSeekIndexHeader(FILE *f, TheoraDecoder *ctx)
+{
+    char magic[4];
+    ogg_uint64_t streamlen, streams, tserialno, vserialno, count;
+
+    if ((fread(magic, 4, 1, f) != 1) || (memcmp(magic, "TPSI", 4) != 0))
+        return -1;
+    else if (fgetc(f) != SEEKINDEX_FILE_VERSION)
+        return -1;
+    else if (!ReadVarint(f, &streamlen) || !ReadVarint(f, &streams) ||
+             !ReadVarint(f, &tserialno) || !ReadVarint(f, &vserialno) ||
+             !ReadVarint(f, &count))
+        return -1;
+    else if (streamlen != (ogg_uint64_t) ctx->streamlen)
+        return -1;  // different file, or it changed.
+    else if (streams != (ogg_uint64_t) ((ctx->tpackets ? 1 : 0) | (ctx->vpackets ? 2 : 0)))
+        return -1;
+    else if (tserialno != (ctx->tpackets ? (ogg_uint64_t) (unsigned int) ctx->tserialno : 0))
+        return -1;
+    else if (vserialno != (ctx->vpackets ? (ogg_uint64_t) (unsigned int) ctx->vserialno : 0))
+        return -1;
+    else if (count > (ogg_uint64_t) (ctx->streamlen / 27))
+        return -1;  // more pages than could fit in the stream (27 bytes is the smallest page header).
+    else if (count > (0xFFFFFFFF / sizeof (SeekIndexEntry)))
+        return -1;  // more than we can allocate.
+    return (long) count;
+} // ReadSeekIndexHeader
+#endif
+
+
+int THEORAPLAY_saveSeekIndex(THEORAPLAY_Decoder *decoder, const char *fname)
+{
+#ifdef THEORAPLAY_NO_FOPEN_FALLBACK
+    return 0;
+#else
+    TheoraDecoder *ctx = (TheoraDecoder *) decoder;
+    SeekIndex copy;
+    ogg_int64_t prevoffset = 0;
+    ogg_int64_t prevgranulepos = 0;
+    unsigned int i;
+    FILE *f;
+    int ok;
+
+    if (!ctx || !AtomicGetUInt(&ctx->prepped) || (ctx->streamlen == -1))
+        return 0;
+
+    // copy it so we don't hold up the decoder while we write.
+    memset(&copy, '\0', sizeof (copy));
+    Mutex_Lock(ctx->indexlock);
+    ok = MergeSeekIndex(&ctx->allocator, &copy, &ctx->seekindex);
+    Mutex_Unlock(ctx->indexlock);
+    if (!ok)
+        return 0;
+
+    f = fopen(fname, "wb");
+    ok = (f != NULL) && WriteSeekIndexHeader(f, ctx, copy.len);
+    for (i = 0; ok && (i < copy.len); i++)
+    {
+        const SeekIndexEntry *entry = &copy.entries[i];
+        ok = WriteVarint(f, (((ogg_uint64_t) (entry->offset - prevoffset)) << 1) | (entry->joined ? 1 : 0)) &&
+             WriteVarint(f, ZigZag(entry->granulepos - prevgranulepos));
+        prevoffset = entry->offset;
+        prevgranulepos = entry->granulepos;
+    } // for
+
+    if (f && (fclose(f) != 0))
+        ok = 0;
+    if (f && !ok)
+        remove(fname);  // don't leave a truncated file to trip over later.
+
+    FreeSeekIndex(&ctx->allocator, &copy);
+    return ok;
+#endif
+} // THEORAPLAY_saveSeekIndex
+
+
+int THEORAPLAY_loadSeekIndex(THEORAPLAY_Decoder *decoder, const char *fname)
+{
+#ifdef THEORAPLAY_NO_FOPEN_FALLBACK
+    return 0;
+#else
+    TheoraDecoder *ctx = (TheoraDecoder *) decoder;
+    SeekIndex loaded;
+    ogg_int64_t offset = 0;
+    ogg_int64_t granulepos = 0;
+    long count;
+    FILE *f;
+    int ok;
+
+    if (!ctx || !AtomicGetUInt(&ctx->prepped) || (ctx->streamlen == -1))
+        return 0;
+
+    f = fopen(fname, "rb");
+    if (f == NULL)
+        return 0;
+
+    memset(&loaded, '\0', sizeof (loaded));
+    count = ReadSeekIndexHeader(f, ctx);
+    ok = (count >= 0);
+    if (ok && (count > 0))
+    {
+        loaded.entries = (SeekIndexEntry *) ctx->allocator.allocate(&ctx->allocator, sizeof (SeekIndexEntry) * (unsigned int) count);
+        ok = (loaded.entries != NULL);
+        loaded.cap = (unsigned int) count;
+    } // if
+
+    while (ok && (loaded.len < (unsigned int) count))
+    {
+        ogg_uint64_t offsetdelta, granuledelta;
+        ok = ReadVarint(f, &offsetdelta) && ReadVarint(f, &granuledelta);
+        if (ok)
+        {
+            const int joined = (int) (offsetdelta & 1);
+            offsetdelta >>= 1;
+            // offsets have to go strictly forward and stay in the stream.
+            ok = ((loaded.len == 0) || (offsetdelta > 0)) && (offsetdelta < (ogg_uint64_t) (ctx->streamlen - offset));
+            offset += (ogg_int64_t) offsetdelta;
+            granulepos += UnZigZag(granuledelta);
+            loaded.entries[loaded.len].offset = offset;
+            loaded.entries[loaded.len].granulepos = granulepos;
+            loaded.entries[loaded.len].joined = joined;
+            loaded.len++;
+        } // if
+    } // while
+
+    fclose(f);
+
+    if (ok)
+    {
+        Mutex_Lock(ctx->indexlock);
+        ok = MergeSeekIndex(&ctx->allocator, &ctx->seekindex, &loaded);
+        Mutex_Unlock(ctx->indexlock);
+    } // if
+
+    FreeSeekIndex(&ctx->allocator, &loaded);
+    return ok;
+#endif
+} // THEORAPLAY_loadSeekIndex
+
+
+
+// Thumbnails come from one single-threaded decoder that scrubs from keyframe
+//  to keyframe, visiting the timestamps in file order, so each one after the
+//  first is a short hop forward, and nothing between keyframes gets decoded.
+static const THEORAPLAY_VideoFrame *NextThumbnail(TheoraDecoder *ctx, const unsigned long mspos)
+{
+    THEORAPLAY_Decoder *decoder = (THEORAPLAY_Decoder *) ctx;
+    const unsigned int generation = THEORAPLAY_seekKeyframe(decoder, mspos);
+    const THEORAPLAY_VideoFrame *video;
+    const THEORAPLAY_AudioPacket *audio;
+
+    while (THEORAPLAY_isDecoding(decoder))
+    {
+        THEORAPLAY_pumpDecode(decoder, 1);
+
+        while ((audio = THEORAPLAY_getAudio(decoder)) != NULL)
+            THEORAPLAY_freeAudio(audio);  // anything decoded before the first seek.
+
+        while ((video = THEORAPLAY_getVideo(decoder)) != NULL)
+        {
+            if (video->seek_generation == generation)
+                return video;
+            THEORAPLAY_freeVideo(video);
+        } // while
+
+        if (ctx->scrub_parked)
+            break;  // parked without a picture? Corrupt keyframe, probably.
+    } // while
+
+    return NULL;
+} // NextThumbnail
+
+// Once we've run off the end of the stream, every later timestamp gets the
+//  last keyframe, so we hand out copies of the thumbnail we already made.
+static const THEORAPLAY_VideoFrame *CopyThumbnail(TheoraDecoder *ctx, const THEORAPLAY_VideoFrame *src)
+{
+    const unsigned int pixelslen = ((const PooledVideoFrame *) src)->pixelslen;
+    VideoFrame *item = GetPooledVideoFrame(ctx->framepool, pixelslen);
+    int i;
+
+    if (item == NULL)
+        return NULL;
+
+    item->seek_generation = src->seek_generation;
+    item->playms = src->playms;
+    item->fps = src->fps;
+    item->width = src->width;
+    item->height = src->height;
+    item->format = src->format;
+    memcpy(item->pixels, src->pixels, pixelslen);
+    for (i = 0; i < 3; i++)
+    {
+        item->planes[i] = src->planes[i];
+        if (src->planes[i].data)
+            item->planes[i].data = item->pixels + (src->planes[i].data - src->pixels);
+    } // for
+
+    return item;
+} // CopyThumbnail
+
+int THEORAPLAY_getThumbnails(THEORAPLAY_Io *io, const unsigned long *mspos,
+                             const unsigned int count, const unsigned int width,
+                             const unsigned int height, THEORAPLAY_VideoFormat vidfmt,
+                             const THEORAPLAY_Allocator *allocator,
+                             const THEORAPLAY_VideoFrame **thumbnails)
+{
+    THEORAPLAY_Io64 *io64;
+
+    #ifdef THEORAPLAY_NO_MALLOC_FALLBACK
+    if (allocator == NULL) {
+        io->close(io);
+        return 0;
+    }
+    #else
+    THEORAPLAY_Allocator malloc_fallback_allocator;
+    if (allocator == NULL) {
+        malloc_fallback_allocator.allocate = malloc_fallback_allocate;
+        malloc_fallback_allocator.deallocate = malloc_fallback_deallocate;
+        malloc_fallback_allocator.userdata = NULL;
+        allocator = &malloc_fallback_allocator;
+    }
+    #endif
+
+    io64 = IoLegacyOpen(io, allocator);
+    if (io64 == NULL)  // this closed io for us.
+        return 0;
+
+    return THEORAPLAY_getThumbnailsIo64(io64, mspos, count, width, height, vidfmt, allocator, thumbnails);
+} // THEORAPLAY_getThumbnails
+
+int THEORAPLAY_getThumbnailsIo64(THEORAPLAY_Io64 *io, const unsigned long *mspos,
+                                 const unsigned int count, const unsigned int width,
+                                 const unsigned int height, THEORAPLAY_VideoFormat vidfmt,
+                                 const THEORAPLAY_Allocator *allocator,
+                                 const THEORAPLAY_VideoFrame **thumbnails)
+{
+    const unsigned int w = width & ~1;  // 4:2:0 wants even sizes.
+    const unsigned int h = height & ~1;
+    const THEORAPLAY_VideoFrame *prev = NULL;
+    THEORAPLAY_DecoderOptions options;
+    THEORAPLAY_Decoder *decoder = NULL;
+    TheoraDecoder *ctx = NULL;
+    unsigned int *order = NULL;
+    unsigned int i;
+    int retval = 0;
+
+    #ifdef THEORAPLAY_NO_MALLOC_FALLBACK
+    if (allocator == NULL) {
+        io->close(io);
+        return 0;
+    }
+    #else
+    THEORAPLAY_Allocator malloc_fallback_allocator;
+    if (allocator == NULL) {
+        malloc_fallback_allocator.allocate = malloc_fallback_allocate;
+        malloc_fallback_allocator.deallocate = malloc_fallback_deallocate;
+        malloc_fallback_allocator.userdata = NULL;
+        allocator = &malloc_fallback_allocator;
+    }
+    #endif
+
+    if (thumbnails)
+    {
+        for (i = 0; i < count; i++)
+            thumbnails[i] = NULL;
+    } // if
+
+    if (!thumbnails || !mspos || (count == 0) || (w == 0) || (h == 0) || !io->seek)
+    {
+        io->close(io);
+        return 0;
+    } // if
+
+    // sort the timestamps into file order. Insertion sort, since there's
+    //  no qsort_r everywhere, and this is nothing next to decoding anyhow.
+    order = (unsigned int *) allocator->allocate(allocator, sizeof (unsigned int) * count);
+    if (order == NULL)
+    {
+        io->close(io);
+        return 0;
+    } // if
+
+    for (i = 0; i < count; i++)
+    {
+        unsigned int j = i;
+        while ((j > 0) && (mspos[order[j - 1]] > mspos[i]))
+        {
+            order[j] = order[j - 1];
+            j--;
+        } // while
+        order[j] = i;
+    } // for
+
+    memset(&options, '\0', sizeof (options));
+    options.output_width = w;
+    options.output_height = h;
+    decoder = THEORAPLAY_startDecodeIo64(io, 1, vidfmt, allocator, 0, &options);
+    if (decoder == NULL)  // this closed io for us.
+    {
+        allocator->deallocate(allocator, order);
+        return 0;
+    } // if
+
+    ctx = (TheoraDecoder *) decoder;
+    while (!THEORAPLAY_isInitialized(decoder) && THEORAPLAY_isDecoding(decoder))
+        THEORAPLAY_pumpDecode(decoder, 1);
+
+    if (THEORAPLAY_hasVideoStream(decoder))
+    {
+        for (i = 0; i < count; i++)
+        {
+            const THEORAPLAY_VideoFrame *thumb = NextThumbnail(ctx, mspos[order[i]]);
+            const int ended = !THEORAPLAY_isDecoding(decoder);
+            if (!thumb && ended && prev && !THEORAPLAY_decodingError(decoder))
+                thumb = CopyThumbnail(ctx, prev);  // past the end of the stream.
+            if (thumb)
+            {
+                thumbnails[order[i]] = prev = thumb;
+                retval++;
+            } // if
+            else if (ended)
+                break;  // nothing more to be had.
+            // else we parked without a picture; leave this one NULL and move on.
+        } // for
+    } // if
+
+    THEORAPLAY_stopDecode(decoder);  // the thumbnails outlive it, like any other frame.
+    allocator->deallocate(allocator, order);
+    return retval;
+} // THEORAPLAY_getThumbnailsIo64
+
+int THEORAPLAY_getThumbnailsFile(const char *fname, const unsigned long *mspos,
+                                 const unsigned int count, const unsigned int width,
+                                 const unsigned int height, THEORAPLAY_VideoFormat vidfmt,
+                                 const THEORAPLAY_Allocator *allocator,
+                                 const THEORAPLAY_VideoFrame **thumbnails)
+{
+#ifdef THEORAPLAY_NO_FOPEN_FALLBACK
+    return 0;
+#else
+    THEORAPLAY_Io64 *io;
+
+    #ifdef THEORAPLAY_NO_MALLOC_FALLBACK
+    if (allocator == NULL) {
+        return 0;
+    }
+    #else
+    THEORAPLAY_Allocator malloc_fallback_allocator;
+    if (allocator == NULL) {
+        malloc_fallback_allocator.allocate = malloc_fallback_allocate;
+        malloc_fallback_allocator.deallocate = malloc_fallback_deallocate;
+        malloc_fallback_allocator.userdata = NULL;
+        allocator = &malloc_fallback_allocator;
+    }
+    #endif
+
+    io = IoFopenOpen(fname, allocator);
+    if (io == NULL)
+        return 0;
+
+    return THEORAPLAY_getThumbnailsIo64(io, mspos, count, width, height, vidfmt, allocator, thumbnails);
+#endif
+} // THEORAPLAY_getThumbnailsFile
+
 // end of theoraplay.c ...
 
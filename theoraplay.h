@@ -9,6 +9,8 @@
 #ifndef _INCL_THEORAPLAY_H_
 #define _INCL_THEORAPLAY_H_
 
+#include <stddef.h>  /* size_t */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -23,6 +25,19 @@ struct THEORAPLAY_Io
     void *userdata;
 };
 
+/* Same as THEORAPLAY_Io, but with 64-bit stream offsets, for files over 2
+   gigabytes on platforms where long is 32 bits. Use it with
+   THEORAPLAY_startDecodeIo64(). */
+typedef struct THEORAPLAY_Io64 THEORAPLAY_Io64;
+struct THEORAPLAY_Io64
+{
+    long (*read)(THEORAPLAY_Io64 *io, void *buf, long buflen);
+    long long (*streamlen)(THEORAPLAY_Io64 *io);
+    int (*seek)(THEORAPLAY_Io64 *io, long long absolute_offset);
+    void (*close)(THEORAPLAY_Io64 *io);
+    void *userdata;
+};
+
 typedef struct THEORAPLAY_Allocator THEORAPLAY_Allocator;
 struct THEORAPLAY_Allocator
 {
@@ -42,9 +57,35 @@ typedef enum THEORAPLAY_VideoFormat
     THEORAPLAY_VIDFMT_RGB,   /* 24 bits packed pixel RGB */
     THEORAPLAY_VIDFMT_RGBA,  /* 32 bits packed pixel RGBA (full alpha). */
     THEORAPLAY_VIDFMT_BGRA,  /* 32 bits packed pixel BGRA (full alpha). */
-    THEORAPLAY_VIDFMT_RGB565 /* 16 bits packed pixel RGB565. */
+    THEORAPLAY_VIDFMT_RGB565, /* 16 bits packed pixel RGB565. */
+    THEORAPLAY_VIDFMT_PLANES  /* planar YCbCr 4:2:0 as the decoder made it; use THEORAPLAY_VideoFrame::planes. */
 } THEORAPLAY_VideoFormat;
 
+/* Which vector code the RGB converters use. By default, TheoraPlay picks the
+   best one the CPU supports. You can force a specific tier, to debug or compare
+   them, with THEORAPLAY_setConvertTier() or the THEORAPLAY_CONVERT_TIER
+   environment variable ("scalar", "sse2", "avx2", or "neon"). If the forced
+   tier isn't available on this CPU, you get the best one below it. */
+typedef enum THEORAPLAY_ConvertTier
+{
+    THEORAPLAY_CVTTIER_AUTO,    /* best available (the default). */
+    THEORAPLAY_CVTTIER_SCALAR,  /* plain C. */
+    THEORAPLAY_CVTTIER_SSE2,    /* x86 SSE2. */
+    THEORAPLAY_CVTTIER_AVX2,    /* x86 AVX2. */
+    THEORAPLAY_CVTTIER_NEON     /* ARM NEON. */
+} THEORAPLAY_ConvertTier;
+
+/* One plane of a video frame. data points at the top-left pixel of the
+   picture, and each row is stride bytes after the previous one. The stride
+   can be wider than the picture, and it can be negative! */
+typedef struct THEORAPLAY_VideoPlane
+{
+    const unsigned char *data;
+    int stride;
+    unsigned int width;
+    unsigned int height;
+} THEORAPLAY_VideoPlane;
+
 typedef struct THEORAPLAY_VideoFrame
 {
     unsigned int seek_generation;  /* when seeking, throw away any frames from previous seek generation. */
@@ -54,6 +95,7 @@ typedef struct THEORAPLAY_VideoFrame
     unsigned int height;
     THEORAPLAY_VideoFormat format;
     unsigned char *pixels;
+    THEORAPLAY_VideoPlane planes[3];  /* Y', Cb, Cr. Packed formats only use planes[0]. */
     struct THEORAPLAY_VideoFrame *next;
 } THEORAPLAY_VideoFrame;
 
@@ -68,6 +110,36 @@ typedef struct THEORAPLAY_AudioPacket
     struct THEORAPLAY_AudioPacket *next;
 } THEORAPLAY_AudioPacket;
 
+/* A shared pool of decoding threads. Instead of every multithreaded decoder
+   getting a thread of its own, decoders attached to a scheduler take turns
+   on its threads, a frame at a time, and whichever decoder has the fewest
+   frames buffered goes first. Good for showing lots of videos at once. */
+typedef struct THEORAPLAY_Scheduler THEORAPLAY_Scheduler;
+
+/* Extra knobs for THEORAPLAY_startDecodeEx(). Zero out the whole struct to get
+   the defaults, then set the fields you care about. */
+typedef struct THEORAPLAY_DecoderOptions
+{
+    unsigned int convert_threads;  /* extra threads to split color conversion across. 0 converts on the decoding thread. */
+    int pipeline;  /* non-zero to convert on a separate stage, so it overlaps decoding the next frame. */
+    THEORAPLAY_Scheduler *scheduler;  /* if multithreaded, decode on this scheduler's threads instead of a new one. */
+    unsigned int output_width;  /* if this and output_height are both 2 or more, scale frames to this size (rounded down to even) while converting them. */
+    unsigned int output_height;  /* scaled THEORAPLAY_VIDFMT_PLANES frames are laid out like IYUV. */
+    unsigned int read_size;  /* bytes to ask the Io for at once. 0 means 4096, and anything over 4 megabytes means 4 megabytes. See THEORAPLAY_READSIZE_ADAPTIVE. */
+    unsigned int readahead;  /* if non-zero, a thread reads up to this many bytes ahead of the decoder, so slow Io reads overlap decoding. */
+} THEORAPLAY_DecoderOptions;
+
+/* Set read_size to this to have the decoder pick it: reads grow with the
+   stream's bitrate during playback, and stay small while seeking. */
+#define THEORAPLAY_READSIZE_ADAPTIVE 0xFFFFFFFF
+
+/* allocator may be NULL, like THEORAPLAY_startDecode(). Stop every decoder
+   using a scheduler before you destroy it. Returns NULL on failure, or if
+   this build has no threads. */
+THEORAPLAY_Scheduler *THEORAPLAY_createScheduler(const unsigned int threads,
+                                                 const THEORAPLAY_Allocator *allocator);
+void THEORAPLAY_destroyScheduler(THEORAPLAY_Scheduler *scheduler);
+
 THEORAPLAY_Decoder *THEORAPLAY_startDecodeFile(const char *fname,
                                                const unsigned int maxframes,
                                                THEORAPLAY_VideoFormat vidfmt,
@@ -78,6 +150,50 @@ THEORAPLAY_Decoder *THEORAPLAY_startDecode(THEORAPLAY_Io *io,
                                            THEORAPLAY_VideoFormat vidfmt,
                                            const THEORAPLAY_Allocator *allocator,
                                            const int multithreaded);
+
+/* Same as above, but options may be NULL for the defaults. */
+THEORAPLAY_Decoder *THEORAPLAY_startDecodeFileEx(const char *fname,
+                                                 const unsigned int maxframes,
+                                                 THEORAPLAY_VideoFormat vidfmt,
+                                                 const THEORAPLAY_Allocator *allocator,
+                                                 const int multithreaded,
+                                                 const THEORAPLAY_DecoderOptions *options);
+THEORAPLAY_Decoder *THEORAPLAY_startDecodeEx(THEORAPLAY_Io *io,
+                                             const unsigned int maxframes,
+                                             THEORAPLAY_VideoFormat vidfmt,
+                                             const THEORAPLAY_Allocator *allocator,
+                                             const int multithreaded,
+                                             const THEORAPLAY_DecoderOptions *options);
+THEORAPLAY_Decoder *THEORAPLAY_startDecodeIo64(THEORAPLAY_Io64 *io,
+                                               const unsigned int maxframes,
+                                               THEORAPLAY_VideoFormat vidfmt,
+                                               const THEORAPLAY_Allocator *allocator,
+                                               const int multithreaded,
+                                               const THEORAPLAY_DecoderOptions *options);
+
+/* An Io that memory-maps the whole file instead of reading it. Hand it to
+   THEORAPLAY_startDecodeIo64() like any other Io; the decoder notices and
+   parses Ogg pages right out of the mapping, skipping the copies and the
+   read() calls. allocator may be NULL. Returns NULL on failure, for empty
+   files, or if this platform can't map files. Don't truncate the file while
+   it's mapped; touching the missing pages can kill the process with SIGBUS. */
+THEORAPLAY_Io64 *THEORAPLAY_createMmapIo(const char *fname,
+                                         const THEORAPLAY_Allocator *allocator);
+
+/* Decode a stream that's already in memory. Pages go to libogg straight out
+   of buf, and seeking is just moving a pointer. buf isn't copied, so it has
+   to stay put until you stop the decoder. allocator and options may be NULL.
+   THEORAPLAY_createMemoryIo() gives you the same thing as an Io, for the
+   other Io64 functions; closing it leaves buf alone. */
+THEORAPLAY_Decoder *THEORAPLAY_startDecodeMemory(const void *buf, const size_t len,
+                                                 const unsigned int maxframes,
+                                                 THEORAPLAY_VideoFormat vidfmt,
+                                                 const THEORAPLAY_Allocator *allocator,
+                                                 const int multithreaded,
+                                                 const THEORAPLAY_DecoderOptions *options);
+THEORAPLAY_Io64 *THEORAPLAY_createMemoryIo(const void *buf, const size_t len,
+                                           const THEORAPLAY_Allocator *allocator);
+
 void THEORAPLAY_stopDecode(THEORAPLAY_Decoder *decoder);
 
 // call this frequently if not multithreaded! Safe no-op if multithreaded.
@@ -91,12 +207,50 @@ int THEORAPLAY_hasAudioStream(THEORAPLAY_Decoder *decoder);
 unsigned int THEORAPLAY_availableVideo(THEORAPLAY_Decoder *decoder);
 unsigned int THEORAPLAY_availableAudio(THEORAPLAY_Decoder *decoder);
 
+/* These don't take a lock, so call getAudio from only one thread at a time,
+   and getVideo from only one thread at a time (it can be a different one). */
 const THEORAPLAY_AudioPacket *THEORAPLAY_getAudio(THEORAPLAY_Decoder *decoder);
 void THEORAPLAY_freeAudio(const THEORAPLAY_AudioPacket *item);
 
 const THEORAPLAY_VideoFrame *THEORAPLAY_getVideo(THEORAPLAY_Decoder *decoder);
 void THEORAPLAY_freeVideo(const THEORAPLAY_VideoFrame *item);
 
+/* Freed video frames are recycled, up to maxframes plus a few. A hit is a
+   frame that came back out of the pool, a miss needed a fresh allocation.
+   Either pointer may be NULL. */
+void THEORAPLAY_getFramePoolStats(THEORAPLAY_Decoder *decoder, unsigned long *hits, unsigned long *misses);
+
+/* This only affects decoders started after the call. THEORAPLAY_CVTTIER_AUTO
+   goes back to the environment variable, or autodetection if that's unset. */
+void THEORAPLAY_setConvertTier(THEORAPLAY_ConvertTier tier);
+
+/* The tier a decoder actually ended up with. YV12 and IYUV always report
+   THEORAPLAY_CVTTIER_SCALAR, as they're just memcpy'd. */
+THEORAPLAY_ConvertTier THEORAPLAY_getConvertTier(THEORAPLAY_Decoder *decoder);
+
+/* Theora's post-processing smooths out blocky artifacts, at some CPU cost.
+   It's off (level 0) by default. Set a level from 0 up to
+   THEORAPLAY_getMaxPostProcessingLevel() (which is 0 until the decoder is
+   initialized), or THEORAPLAY_PPLEVEL_ADAPTIVE to have the decoder raise it
+   while it's well ahead of you and drop it again when your video queue runs
+   low. Levels above the maximum are clamped. Get tells you the level frames
+   are coming out at now. */
+#define THEORAPLAY_PPLEVEL_ADAPTIVE -1
+void THEORAPLAY_setPostProcessingLevel(THEORAPLAY_Decoder *decoder, const int level);
+int THEORAPLAY_getPostProcessingLevel(THEORAPLAY_Decoder *decoder);
+int THEORAPLAY_getMaxPostProcessingLevel(THEORAPLAY_Decoder *decoder);
+
+/* Tell the decoder where playback is, in the same milliseconds as playms, so
+   it can skip converting and queueing frames that are already a whole frame
+   late by then. They still get decoded, as later frames need them. Call it
+   whenever you check the time; seeking forgets it until you call it again.
+   If you never call it, nothing is dropped. Frames are never dropped while
+   the video queue is empty, so you always have something to show. */
+void THEORAPLAY_setPlaybackTime(THEORAPLAY_Decoder *decoder, const unsigned int playms);
+
+/* How many frames were dropped for being late, since the decoder started. */
+unsigned int THEORAPLAY_getDroppedFrames(THEORAPLAY_Decoder *decoder);
+
 /* Seeking is experimental! Don't complain to me if it's buggy, slow, or flakey! */
 /* This returns a "seek generation". The default generation on a decoder is 0.
    If you seek, you should track the current seek generation returned by this
@@ -105,6 +259,67 @@ void THEORAPLAY_freeVideo(const THEORAPLAY_VideoFrame *item);
    seek request. */
 unsigned int THEORAPLAY_seek(THEORAPLAY_Decoder *decoder, unsigned long mspos);
 
+/* For scrubbing along a timeline, when you want something on the screen fast
+   more than you want the exact frame. This works like THEORAPLAY_seek(), but
+   only decodes keyframes and skips audio entirely, and you get exactly one
+   video frame: the last keyframe at or before mspos. Then the decoder waits
+   until you seek again; use THEORAPLAY_seek() to resume normal playback.
+   Streams without video just seek normally. */
+unsigned int THEORAPLAY_seekKeyframe(THEORAPLAY_Decoder *decoder, unsigned long mspos);
+
+/* After a seek lands, how many frames the decoder had to decode and throw
+   away between the keyframe it started from and the one you asked for. Handy
+   for judging how far apart a file's keyframes are. Reset by each seek. */
+unsigned int THEORAPLAY_getSeekCatchupFrames(THEORAPLAY_Decoder *decoder);
+
+/* Seek indexes. As a decoder plays, it notes where the keyframes are, so
+   seeking back into anywhere it's already been skips the slow search through
+   the file. These fill in the rest ahead of time. They all fail (return zero)
+   until THEORAPLAY_isInitialized() says the decoder is ready. */
+
+/* Walk the whole stream's pages on a low-priority thread, without decoding
+   anything, and add them to the index when it's done. io must be a second,
+   independent Io on the same stream; the decoder closes it when the scan is
+   done, or right away if this fails. Only one scan per decoder. */
+int THEORAPLAY_startIndexScan(THEORAPLAY_Decoder *decoder, THEORAPLAY_Io *io);
+int THEORAPLAY_startIndexScanIo64(THEORAPLAY_Decoder *decoder, THEORAPLAY_Io64 *io);
+int THEORAPLAY_startIndexScanFile(THEORAPLAY_Decoder *decoder, const char *fname);
+int THEORAPLAY_isIndexScanning(THEORAPLAY_Decoder *decoder);
+
+/* Save the index to a small sidecar file, so next time you open the same
+   stream, you can load it and seek quickly right away. Loading refuses files
+   saved from a different stream (it checks the stream length and serial
+   numbers), and adds to whatever the decoder has already indexed. */
+int THEORAPLAY_saveSeekIndex(THEORAPLAY_Decoder *decoder, const char *fname);
+int THEORAPLAY_loadSeekIndex(THEORAPLAY_Decoder *decoder, const char *fname);
+
+/* Timeline thumbnails: one small picture for each of count timestamps, made
+   with a single decoder that visits them in file order and only decodes
+   keyframes, so each thumbnail is the last keyframe at or before its time.
+   thumbnails must have room for count pointers; they come back in the same
+   order as mspos, with their playms set to the keyframe's time. width and
+   height are rounded down to even numbers, and the picture is stretched to
+   fit them. THEORAPLAY_VIDFMT_PLANES thumbnails are laid out like IYUV.
+   Free each one with THEORAPLAY_freeVideo(). Returns how many were made;
+   if that's less than count, the ones that couldn't be made are NULL. Like THEORAPLAY_startDecode(),
+   this closes io when it's done, and allocator may be NULL. io has to be
+   able to seek. */
+int THEORAPLAY_getThumbnails(THEORAPLAY_Io *io, const unsigned long *mspos,
+                             const unsigned int count, const unsigned int width,
+                             const unsigned int height, THEORAPLAY_VideoFormat vidfmt,
+                             const THEORAPLAY_Allocator *allocator,
+                             const THEORAPLAY_VideoFrame **thumbnails);
+int THEORAPLAY_getThumbnailsIo64(THEORAPLAY_Io64 *io, const unsigned long *mspos,
+                                 const unsigned int count, const unsigned int width,
+                                 const unsigned int height, THEORAPLAY_VideoFormat vidfmt,
+                                 const THEORAPLAY_Allocator *allocator,
+                                 const THEORAPLAY_VideoFrame **thumbnails);
+int THEORAPLAY_getThumbnailsFile(const char *fname, const unsigned long *mspos,
+                                 const unsigned int count, const unsigned int width,
+                                 const unsigned int height, THEORAPLAY_VideoFormat vidfmt,
+                                 const THEORAPLAY_Allocator *allocator,
+                                 const THEORAPLAY_VideoFrame **thumbnails);
+
 #ifdef __cplusplus
 }
 #endif
@@ -39,12 +39,14 @@
 #  endif
 #endif
 
-static unsigned char *THEORAPLAY_CVT_FNNAME_420(const THEORAPLAY_Allocator *allocator, const th_info *tinfo, const th_ycbcr_buffer ycbcr)
+#ifndef THEORAPLAY_CVT_RGB_FNATTR
+#define THEORAPLAY_CVT_RGB_FNATTR
+#endif
+
+static THEORAPLAY_CVT_RGB_FNATTR void THEORAPLAY_CVT_FNNAME_420(const th_info *tinfo, const th_ycbcr_buffer ycbcr, unsigned char *pixels, const int firstrow, const int endrow)
 {
     const int w = tinfo->pic_width;
-    const int h = tinfo->pic_height;
     const int halfw = w / 2;
-    unsigned char *pixels = (unsigned char *) allocator->allocate(allocator, THEORAPLAY_CVT_RGB_DST_BUFFER_SIZE(w, h));
 
     // http://www.theora.org/doc/Theora.pdf, 1.1 spec,
     //  chapter 4.2 (Y'CbCr -> Y'PbPr -> R'G'B')
@@ -59,253 +61,353 @@ static unsigned char *THEORAPLAY_CVT_FNNAME_420(const THEORAPLAY_Allocator *allo
     const float kb = 0.114f;
     #endif
 
-    if (pixels)
+    unsigned char *dst = pixels + THEORAPLAY_CVT_RGB_DST_BUFFER_SIZE(w, firstrow);
+    unsigned char *dst2 = dst + THEORAPLAY_CVT_RGB_DST_BUFFER_SIZE(w, 1);
+    const int ystride = ycbcr[0].stride;
+    const int cbstride = ycbcr[1].stride;
+    const unsigned char *py;
+    const unsigned char *pcb;
+    const unsigned char *pcr;
+    int posy;
+
+    #if !PRECALC_YUVRGB_VALS
+    const int crstride = ycbcr[2].stride;
+    const int FIXED_POINT_BITS = 7;
+    const int yoffset = 16;
+    const int yfactor = (int) ((255.0f / yexcursion) * (1<<FIXED_POINT_BITS));
+    const int krfactor = (int) ((255.0f * (2.0f * (1.0f - kr)) / cbcrexcursion) * (1<<FIXED_POINT_BITS));
+    const int kbfactor = (int) ((255.0f * (2.0f * (1.0f - kb)) / cbcrexcursion) * (1<<FIXED_POINT_BITS));
+    const int green_krfactor = (int) ((kr / ((1.0f - kb) - kr) * 255.0f * (2.0f * (1.0f - kr)) / cbcrexcursion) * (1<<FIXED_POINT_BITS));
+    const int green_kbfactor = (int) ((kb / ((1.0f - kb) - kr) * 255.0f * (2.0f * (1.0f - kb)) / cbcrexcursion) * (1<<FIXED_POINT_BITS));
+    #else
+    #define FIXED_POINT_BITS 7
+    #define cbcroffset 128
+    #define yoffset 16
+    #define yfactor 149
+    #define krfactor 204
+    #define kbfactor 258
+    #define green_krfactor 104
+    #define green_kbfactor 50
+    #define crstride cbstride
+    assert(ycbcr[1].stride == ycbcr[2].stride);  // otherwise crstride will be wrong!
+    #endif
+
     {
-        unsigned char *dst = pixels;
-        unsigned char *dst2 = dst + THEORAPLAY_CVT_RGB_DST_BUFFER_SIZE(w, 1);
-        const int ystride = ycbcr[0].stride;
-        const int cbstride = ycbcr[1].stride;
-        const unsigned char *py;
-        const unsigned char *pcb;
-        const unsigned char *pcr;
-        int posy;
-
-        #if !PRECALC_YUVRGB_VALS
-        const int crstride = ycbcr[2].stride;
-        const int FIXED_POINT_BITS = 7;
-        const int yoffset = 16;
-        const int yfactor = (int) ((255.0f / yexcursion) * (1<<FIXED_POINT_BITS));
-        const int krfactor = (int) ((255.0f * (2.0f * (1.0f - kr)) / cbcrexcursion) * (1<<FIXED_POINT_BITS));
-        const int kbfactor = (int) ((255.0f * (2.0f * (1.0f - kb)) / cbcrexcursion) * (1<<FIXED_POINT_BITS));
-        const int green_krfactor = (int) ((kr / ((1.0f - kb) - kr) * 255.0f * (2.0f * (1.0f - kr)) / cbcrexcursion) * (1<<FIXED_POINT_BITS));
-        const int green_kbfactor = (int) ((kb / ((1.0f - kb) - kr) * 255.0f * (2.0f * (1.0f - kb)) / cbcrexcursion) * (1<<FIXED_POINT_BITS));
-        #else
-        #define FIXED_POINT_BITS 7
-        #define cbcroffset 128
-        #define yoffset 16
-        #define yfactor 149
-        #define krfactor 204
-        #define kbfactor 258
-        #define green_krfactor 104
-        #define green_kbfactor 50
-        #define crstride cbstride
-        assert(ycbcr[1].stride == ycbcr[2].stride);  // otherwise crstride will be wrong!
-        #endif
+        // firstrow is always even, so we start on a fresh pair of rows sharing a line of Cb/Cr.
+        const int yoff = (tinfo->pic_x & ~1) + ystride * ((tinfo->pic_y & ~1) + firstrow);
+        const int cboff = (tinfo->pic_x / 2) + (cbstride) * ((tinfo->pic_y / 2) + (firstrow / 2));
+        py = ycbcr[0].data + yoff;
+        pcb = ycbcr[1].data + cboff;
+        pcr = ycbcr[2].data + cboff;
+    }
+
+    for (posy = firstrow; posy < endrow; posy += 2)
+    {
+        int posx = 0;
+        int poshalfx = 0;
 
+        #if THEORAPLAY_CVT_RGB_USE_NEON
+        while ((halfw - poshalfx) >= 16)
         {
-            const int yoff = (tinfo->pic_x & ~1) + ystride * (tinfo->pic_y & ~1);
-            const int cboff = (tinfo->pic_x / 2) + (cbstride) * (tinfo->pic_y / 2);
-            py = ycbcr[0].data + yoff;
-            pcb = ycbcr[1].data + cboff;
-            pcr = ycbcr[2].data + cboff;
-        }
+            int16x8_t vcb1, vcr1, vcg1;
+            int16x8_t vcb2, vcr2, vcg2;
+            {
+                // load from memory, convert u8 to sint32, subtract the offset
+                #define THEORAPLAY_NEON_PREP_COMPONENT(src, voffset, a, b, c, d) { \
+                    const uint8x16_t v = vld1q_u8((src)); \
+                    { \
+                        const int16x8_t vhalf = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(v))); \
+                        a = vsubq_s32(vmovl_s16(vget_low_s16(vhalf)), voffset);  /* convert first 4 values to int32 */ \
+                        b = vsubq_s32(vmovl_s16(vget_high_s16(vhalf)), voffset);  /* convert second 4 values to int32 */ \
+                    } { \
+                        const int16x8_t vhalf = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(v))); \
+                        c = vsubq_s32(vmovl_s16(vget_low_s16(vhalf)), voffset);  /* convert third 4 values to int32 */ \
+                        d = vsubq_s32(vmovl_s16(vget_high_s16(vhalf)), voffset);  /* convert fourth 4 values to int32 */ \
+                    } \
+                }
 
-        for (posy = 0; posy < h; posy += 2)
-        {
-            int posx = 0;
-            int poshalfx = 0;
+                // factor, downshift, and pack back down to int16x8_t
+                #define THEORAPLAY_NEON_FACTOR_AND_DOWNSHIFT(v1, v2, a, b, c, d, factor, bits) { \
+                    v1 = vcombine_s16(vmovn_s32(vshrq_n_s32(vmulq_n_s32(a, factor), bits)), vmovn_s32(vshrq_n_s32(vmulq_n_s32(b, factor), bits))); \
+                    v2 = vcombine_s16(vmovn_s32(vshrq_n_s32(vmulq_n_s32(c, factor), bits)), vmovn_s32(vshrq_n_s32(vmulq_n_s32(d, factor), bits))); \
+                }
 
-            #if THEORAPLAY_CVT_RGB_USE_NEON
-            while ((halfw - poshalfx) >= 16)
-            {
-                int16x8_t vcb1, vcr1, vcg1;
-                int16x8_t vcb2, vcr2, vcg2;
+                // load, prep, and factor the color components, build out green value, too...
                 {
-                    // load from memory, convert u8 to sint32, subtract the offset
-                    #define THEORAPLAY_NEON_PREP_COMPONENT(src, voffset, a, b, c, d) { \
-                        const uint8x16_t v = vld1q_u8((src)); \
-                        { \
-                            const int16x8_t vhalf = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(v))); \
-                            a = vsubq_s32(vmovl_s16(vget_low_s16(vhalf)), voffset);  /* convert first 4 values to int32 */ \
-                            b = vsubq_s32(vmovl_s16(vget_high_s16(vhalf)), voffset);  /* convert second 4 values to int32 */ \
-                        } { \
-                            const int16x8_t vhalf = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(v))); \
-                            c = vsubq_s32(vmovl_s16(vget_low_s16(vhalf)), voffset);  /* convert third 4 values to int32 */ \
-                            d = vsubq_s32(vmovl_s16(vget_high_s16(vhalf)), voffset);  /* convert fourth 4 values to int32 */ \
-                        } \
-                    }
+                    const int32x4_t vcbcroffset = vdupq_n_s32(cbcroffset);
+                    int32x4_t ga, gb, gc, gd;
 
-                    // factor, downshift, and pack back down to int16x8_t
-                    #define THEORAPLAY_NEON_FACTOR_AND_DOWNSHIFT(v1, v2, a, b, c, d, factor, bits) { \
-                        v1 = vcombine_s16(vmovn_s32(vshrq_n_s32(vmulq_n_s32(a, factor), bits)), vmovn_s32(vshrq_n_s32(vmulq_n_s32(b, factor), bits))); \
-                        v2 = vcombine_s16(vmovn_s32(vshrq_n_s32(vmulq_n_s32(c, factor), bits)), vmovn_s32(vshrq_n_s32(vmulq_n_s32(d, factor), bits))); \
+                    // Process Cb...
+                    {
+                        int32x4_t a, b, c, d;
+                        THEORAPLAY_NEON_PREP_COMPONENT(((const uint8_t *) pcb) + poshalfx, vcbcroffset, a, b, c, d);
+                        THEORAPLAY_NEON_FACTOR_AND_DOWNSHIFT(vcb1, vcb2, a, b, c, d, kbfactor, FIXED_POINT_BITS);
+
+                        // a, b, c, and d are still valid Cb values, start building out Cg from them.
+                        ga = vmulq_n_s32(a, green_kbfactor);
+                        gb = vmulq_n_s32(b, green_kbfactor);
+                        gc = vmulq_n_s32(c, green_kbfactor);
+                        gd = vmulq_n_s32(d, green_kbfactor);
                     }
 
-                    // load, prep, and factor the color components, build out green value, too...
+                    // Process Cr...
                     {
-                        const int32x4_t vcbcroffset = vdupq_n_s32(cbcroffset);
-                        int32x4_t ga, gb, gc, gd;
-
-                        // Process Cb...
-                        {
-                            int32x4_t a, b, c, d;
-                            THEORAPLAY_NEON_PREP_COMPONENT(((const uint8_t *) pcb) + poshalfx, vcbcroffset, a, b, c, d);
-                            THEORAPLAY_NEON_FACTOR_AND_DOWNSHIFT(vcb1, vcb2, a, b, c, d, kbfactor, FIXED_POINT_BITS);
-
-                            // a, b, c, and d are still valid Cb values, start building out Cg from them.
-                            ga = vmulq_n_s32(a, green_kbfactor);
-                            gb = vmulq_n_s32(b, green_kbfactor);
-                            gc = vmulq_n_s32(c, green_kbfactor);
-                            gd = vmulq_n_s32(d, green_kbfactor);
-                        }
-
-                        // Process Cr...
-                        {
-                            int32x4_t a, b, c, d;
-                            THEORAPLAY_NEON_PREP_COMPONENT(((const uint8_t *) pcr) + poshalfx, vcbcroffset, a, b, c, d);
-
-                            /* factor the Cr side into our green component and add it to previous work. */
-                            ga = vaddq_s32(ga, vmulq_n_s32(a, green_krfactor));
-                            gb = vaddq_s32(gb, vmulq_n_s32(b, green_krfactor));
-                            gc = vaddq_s32(gc, vmulq_n_s32(c, green_krfactor));
-                            gd = vaddq_s32(gd, vmulq_n_s32(d, green_krfactor));
-
-                            /* okay, we've got the green work covered, factor Cr, shift for fixed point conversion, and pack it down. */
-                            THEORAPLAY_NEON_FACTOR_AND_DOWNSHIFT(vcr1, vcr2, a, b, c, d, krfactor, FIXED_POINT_BITS);
-                        }
-
-                        // Finish off green...
-                        vcg1 = vcombine_s16(vmovn_s32(vshrq_n_s32(ga, FIXED_POINT_BITS)), vmovn_s32(vshrq_n_s32(gb, FIXED_POINT_BITS)));
-                        vcg2 = vcombine_s16(vmovn_s32(vshrq_n_s32(gc, FIXED_POINT_BITS)), vmovn_s32(vshrq_n_s32(gd, FIXED_POINT_BITS)));
+                        int32x4_t a, b, c, d;
+                        THEORAPLAY_NEON_PREP_COMPONENT(((const uint8_t *) pcr) + poshalfx, vcbcroffset, a, b, c, d);
+
+                        /* factor the Cr side into our green component and add it to previous work. */
+                        ga = vaddq_s32(ga, vmulq_n_s32(a, green_krfactor));
+                        gb = vaddq_s32(gb, vmulq_n_s32(b, green_krfactor));
+                        gc = vaddq_s32(gc, vmulq_n_s32(c, green_krfactor));
+                        gd = vaddq_s32(gd, vmulq_n_s32(d, green_krfactor));
+
+                        /* okay, we've got the green work covered, factor Cr, shift for fixed point conversion, and pack it down. */
+                        THEORAPLAY_NEON_FACTOR_AND_DOWNSHIFT(vcr1, vcr2, a, b, c, d, krfactor, FIXED_POINT_BITS);
                     }
+
+                    // Finish off green...
+                    vcg1 = vcombine_s16(vmovn_s32(vshrq_n_s32(ga, FIXED_POINT_BITS)), vmovn_s32(vshrq_n_s32(gb, FIXED_POINT_BITS)));
+                    vcg2 = vcombine_s16(vmovn_s32(vshrq_n_s32(gc, FIXED_POINT_BITS)), vmovn_s32(vshrq_n_s32(gd, FIXED_POINT_BITS)));
                 }
+            }
 
-                // load Y components and build out pixels! We have enough color components to cover _64_ pixels (32 each in two rows).
+            // load Y components and build out pixels! We have enough color components to cover _64_ pixels (32 each in two rows).
+
+            /* so the gameplan is some magic with vzipq:
+               we start with 16 pixels, with their components in four separate registers:
+
+                 Ra Rb Rc Rd Re Rf Rg Rh Ri Rj Rk Rl Rm Rn Ro Rp
+                 Ga Gb Gc Gd Ge Gf Gg Gh Gi Gj Gk Gl Gm Gn Go Gp
+                 Ba Bb Bc Bd Be Bf Bg Bh Bi Bj Bk Bl Bm Bn Bo Bp
+                 Aa Ab Ac Ad Ae Af Ag Ah Ai Aj Ak Al Am An Ao Ap  (alpha is always 255, so we just vdup_n_u8 this to a register)
+
+               ...and vzipq1 the values so they combine across two registers:
+                 Ra Ga Rb Gb Rc Gc Rd Gd Re Ge Rf Gf Rg Gg Rh Gh
+                 Ba Aa Bb Ab Bc Ac Bd Ad Be Ae Bf Af Bg Ag Bh Ah
+
+               ...then reinterpret those registers as 16 bit values and vzip _those_:
+                 Ra Ga Ba Aa Rb Gb Bb Ab Rc Gc Bc Ac Rd Gd Bd Ad
+
+               ...and then we have four 32-bit pixels in RGBA8888 order ready to be stored out,
+               and we just have to do this again for the other pixels until all 16 are done. */
+            #define THEORAPLAY_NEON_CVT_TO_RGB(dst, src, vcrdup1, vcgdup1, vcbdup1, vcrdup2, vcgdup2, vcbdup2) { \
+                int16x8_t vy1, vy2; \
+                { \
+                    int32x4_t a, b, c, d; \
+                    const int32x4_t vyoffset = vdupq_n_s32(yoffset); \
+                    THEORAPLAY_NEON_PREP_COMPONENT(src, vyoffset, a, b, c, d); \
+                    THEORAPLAY_NEON_FACTOR_AND_DOWNSHIFT(vy1, vy2, a, b, c, d, yfactor, FIXED_POINT_BITS); \
+                } \
+                const uint8x16_t vr = vreinterpretq_u8_s8(vcombine_s8(vmovn_s16(vmaxq_s16(vminq_s16(vaddq_s16(vy1, vcrdup1), vdupq_n_s16(255)), vdupq_n_s16(0))), vmovn_s16(vmaxq_s16(vminq_s16(vaddq_s16(vy2, vcrdup2), vdupq_n_s16(255)), vdupq_n_s16(0))))); \
+                const uint8x16_t vg = vreinterpretq_u8_s8(vcombine_s8(vmovn_s16(vmaxq_s16(vminq_s16(vsubq_s16(vy1, vcgdup1), vdupq_n_s16(255)), vdupq_n_s16(0))), vmovn_s16(vmaxq_s16(vminq_s16(vsubq_s16(vy2, vcgdup2), vdupq_n_s16(255)), vdupq_n_s16(0))))); \
+                const uint8x16_t vb = vreinterpretq_u8_s8(vcombine_s8(vmovn_s16(vmaxq_s16(vminq_s16(vaddq_s16(vy1, vcbdup1), vdupq_n_s16(255)), vdupq_n_s16(0))), vmovn_s16(vmaxq_s16(vminq_s16(vaddq_s16(vy2, vcbdup2), vdupq_n_s16(255)), vdupq_n_s16(0))))); \
+                uint8x16_t vzipa, vzipb; \
+                uint8x16_t vrgba; \
+                vzipa = vzip1q_u8(vr, vg); \
+                vzipb = vzip1q_u8(vb, vdupq_n_u8(255)); \
+                vrgba = vreinterpretq_u8_u16(vzip1q_u16(vreinterpretq_u16_u8(vzipa), vreinterpretq_u16_u8(vzipb))); \
+                THEORAPLAY_CVT_RGB_OUTPUT_NEON(dst, vrgba); \
+                vrgba = vreinterpretq_u8_u16(vzip2q_u16(vreinterpretq_u16_u8(vzipa), vreinterpretq_u16_u8(vzipb))); \
+                THEORAPLAY_CVT_RGB_OUTPUT_NEON(dst, vrgba); \
+                vzipa = vzip2q_u8(vr, vg); \
+                vzipb = vzip2q_u8(vb, vdupq_n_u8(255)); \
+                vrgba = vreinterpretq_u8_u16(vzip1q_u16(vreinterpretq_u16_u8(vzipa), vreinterpretq_u16_u8(vzipb))); \
+                THEORAPLAY_CVT_RGB_OUTPUT_NEON(dst, vrgba); \
+                vrgba = vreinterpretq_u8_u16(vzip2q_u16(vreinterpretq_u16_u8(vzipa), vreinterpretq_u16_u8(vzipb))); \
+                THEORAPLAY_CVT_RGB_OUTPUT_NEON(dst, vrgba); \
+            }
 
-                /* so the gameplan is some magic with vzipq:
-                   we start with 16 pixels, with their components in four separate registers:
+            int16x8_t vcrdup1, vcgdup1, vcbdup1, vcrdup2, vcgdup2, vcbdup2;
 
-                     Ra Rb Rc Rd Re Rf Rg Rh Ri Rj Rk Rl Rm Rn Ro Rp
-                     Ga Gb Gc Gd Ge Gf Gg Gh Gi Gj Gk Gl Gm Gn Go Gp
-                     Ba Bb Bc Bd Be Bf Bg Bh Bi Bj Bk Bl Bm Bn Bo Bp
-                     Aa Ab Ac Ad Ae Af Ag Ah Ai Aj Ak Al Am An Ao Ap  (alpha is always 255, so we just vdup_n_u8 this to a register)
+            /* duplicate every other element (lower half), since pairs of Y values use the same Cr/Cg/Cb components. */
+            vcrdup1 = vzip1q_s16(vcr1, vcr1);
+            vcgdup1 = vzip1q_s16(vcg1, vcg1);
+            vcbdup1 = vzip1q_s16(vcb1, vcb1);
+            vcrdup2 = vzip2q_s16(vcr1, vcr1);
+            vcgdup2 = vzip2q_s16(vcg1, vcg1);
+            vcbdup2 = vzip2q_s16(vcb1, vcb1);
 
-                   ...and vzipq1 the values so they combine across two registers:
-                     Ra Ga Rb Gb Rc Gc Rd Gd Re Ge Rf Gf Rg Gg Rh Gh
-                     Ba Aa Bb Ab Bc Ac Bd Ad Be Ae Bf Af Bg Ag Bh Ah
+            /* get 16 Y values from the first row. */
+            THEORAPLAY_NEON_CVT_TO_RGB(dst, ((const uint8_t *) py) + posx, vcrdup1, vcgdup1, vcbdup1, vcrdup2, vcgdup2, vcbdup2);
 
-                   ...then reinterpret those registers as 16 bit values and vzip _those_:
-                     Ra Ga Ba Aa Rb Gb Bb Ab Rc Gc Bc Ac Rd Gd Bd Ad
+            /* get 16 Y values from the second row. */
+            THEORAPLAY_NEON_CVT_TO_RGB(dst2, ((const uint8_t *) py) + posx + ystride, vcrdup1, vcgdup1, vcbdup1, vcrdup2, vcgdup2, vcbdup2);
 
-                   ...and then we have four 32-bit pixels in RGBA8888 order ready to be stored out,
-                   and we just have to do this again for the other pixels until all 16 are done. */
-                #define THEORAPLAY_NEON_CVT_TO_RGB(dst, src, vcrdup1, vcgdup1, vcbdup1, vcrdup2, vcgdup2, vcbdup2) { \
-                    int16x8_t vy1, vy2; \
-                    { \
-                        int32x4_t a, b, c, d; \
-                        const int32x4_t vyoffset = vdupq_n_s32(yoffset); \
-                        THEORAPLAY_NEON_PREP_COMPONENT(src, vyoffset, a, b, c, d); \
-                        THEORAPLAY_NEON_FACTOR_AND_DOWNSHIFT(vy1, vy2, a, b, c, d, yfactor, FIXED_POINT_BITS); \
-                    } \
-                    const uint8x16_t vr = vreinterpretq_u8_s8(vcombine_s8(vmovn_s16(vmaxq_s16(vminq_s16(vaddq_s16(vy1, vcrdup1), vdupq_n_s16(255)), vdupq_n_s16(0))), vmovn_s16(vmaxq_s16(vminq_s16(vaddq_s16(vy2, vcrdup2), vdupq_n_s16(255)), vdupq_n_s16(0))))); \
-                    const uint8x16_t vg = vreinterpretq_u8_s8(vcombine_s8(vmovn_s16(vmaxq_s16(vminq_s16(vsubq_s16(vy1, vcgdup1), vdupq_n_s16(255)), vdupq_n_s16(0))), vmovn_s16(vmaxq_s16(vminq_s16(vsubq_s16(vy2, vcgdup2), vdupq_n_s16(255)), vdupq_n_s16(0))))); \
-                    const uint8x16_t vb = vreinterpretq_u8_s8(vcombine_s8(vmovn_s16(vmaxq_s16(vminq_s16(vaddq_s16(vy1, vcbdup1), vdupq_n_s16(255)), vdupq_n_s16(0))), vmovn_s16(vmaxq_s16(vminq_s16(vaddq_s16(vy2, vcbdup2), vdupq_n_s16(255)), vdupq_n_s16(0))))); \
-                    uint8x16_t vzipa, vzipb; \
-                    uint8x16_t vrgba; \
-                    vzipa = vzip1q_u8(vr, vg); \
-                    vzipb = vzip1q_u8(vb, vdupq_n_u8(255)); \
-                    vrgba = vreinterpretq_u8_u16(vzip1q_u16(vreinterpretq_u16_u8(vzipa), vreinterpretq_u16_u8(vzipb))); \
-                    THEORAPLAY_CVT_RGB_OUTPUT_NEON(dst, vrgba); \
-                    vrgba = vreinterpretq_u8_u16(vzip2q_u16(vreinterpretq_u16_u8(vzipa), vreinterpretq_u16_u8(vzipb))); \
-                    THEORAPLAY_CVT_RGB_OUTPUT_NEON(dst, vrgba); \
-                    vzipa = vzip2q_u8(vr, vg); \
-                    vzipb = vzip2q_u8(vb, vdupq_n_u8(255)); \
-                    vrgba = vreinterpretq_u8_u16(vzip1q_u16(vreinterpretq_u16_u8(vzipa), vreinterpretq_u16_u8(vzipb))); \
-                    THEORAPLAY_CVT_RGB_OUTPUT_NEON(dst, vrgba); \
-                    vrgba = vreinterpretq_u8_u16(vzip2q_u16(vreinterpretq_u16_u8(vzipa), vreinterpretq_u16_u8(vzipb))); \
-                    THEORAPLAY_CVT_RGB_OUTPUT_NEON(dst, vrgba); \
-                }
+            /* duplicate every other element (upper half), since pairs of Y values use the same Cr/Cg/Cb components. */
+            vcrdup1 = vzip1q_s16(vcr2, vcr2);
+            vcgdup1 = vzip1q_s16(vcg2, vcg2);
+            vcbdup1 = vzip1q_s16(vcb2, vcb2);
+            vcrdup2 = vzip2q_s16(vcr2, vcr2);
+            vcgdup2 = vzip2q_s16(vcg2, vcg2);
+            vcbdup2 = vzip2q_s16(vcb2, vcb2);
 
-                int16x8_t vcrdup1, vcgdup1, vcbdup1, vcrdup2, vcgdup2, vcbdup2;
+            /* get second set of 16 Y values from the first row. */
+            THEORAPLAY_NEON_CVT_TO_RGB(dst, ((const uint8_t *) py) + posx + 16, vcrdup1, vcgdup1, vcbdup1, vcrdup2, vcgdup2, vcbdup2);
 
-                /* duplicate every other element (lower half), since pairs of Y values use the same Cr/Cg/Cb components. */
-                vcrdup1 = vzip1q_s16(vcr1, vcr1);
-                vcgdup1 = vzip1q_s16(vcg1, vcg1);
-                vcbdup1 = vzip1q_s16(vcb1, vcb1);
-                vcrdup2 = vzip2q_s16(vcr1, vcr1);
-                vcgdup2 = vzip2q_s16(vcg1, vcg1);
-                vcbdup2 = vzip2q_s16(vcb1, vcb1);
+            /* get second set of 16 Y values from the second row. */
+            THEORAPLAY_NEON_CVT_TO_RGB(dst2, ((const uint8_t *) py) + posx + ystride + 16, vcrdup1, vcgdup1, vcbdup1, vcrdup2, vcgdup2, vcbdup2);
 
-                /* get 16 Y values from the first row. */
-                THEORAPLAY_NEON_CVT_TO_RGB(dst, ((const uint8_t *) py) + posx, vcrdup1, vcgdup1, vcbdup1, vcrdup2, vcgdup2, vcbdup2);
+            #undef THEORAPLAY_NEON_PREP_COMPONENT
+            #undef THEORAPLAY_NEON_FACTOR_AND_DOWNSHIFT
+            #undef THEORAPLAY_NEON_CVT_TO_RGB
 
-                /* get 16 Y values from the second row. */
-                THEORAPLAY_NEON_CVT_TO_RGB(dst2, ((const uint8_t *) py) + posx + ystride, vcrdup1, vcgdup1, vcbdup1, vcrdup2, vcgdup2, vcbdup2);
+            poshalfx += 16;
+            posx += 32;
+        }
+        #endif
+
+        #if THEORAPLAY_CVT_RGB_USE_SSE2 || THEORAPLAY_CVT_RGB_USE_AVX2
+        /* The x86 paths work on 16-bit lanes. (x * factor) >> FIXED_POINT_BITS can overflow 16 bits for
+           Y', so we prescale both sides so the full product lands exactly 16 bits up and let mulhi
+           hand us the top half. That's bit-for-bit the same as the scalar path's arithmetic shift.
+           Y' needs (x * 64) * (factor * 8), Cb/Cr need (x * 128) * (factor * 4); both are (x * factor) << 9. */
+        #define THEORAPLAY_X86_YSCALE_BITS 6
+        #define THEORAPLAY_X86_CSCALE_BITS 7
+        #define THEORAPLAY_X86_FACTOR_BITS(scalebits) (16 - FIXED_POINT_BITS - (scalebits))
+        #endif
+
+        #if THEORAPLAY_CVT_RGB_USE_SSE2
+        while ((halfw - poshalfx) >= 8)
+        {
+            const __m128i vzero = _mm_setzero_si128();
+            const __m128i vcbcroffset = _mm_set1_epi16(cbcroffset);
+            const __m128i vcb = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (pcb + poshalfx)), vzero), vcbcroffset);
+            const __m128i vcr = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (pcr + poshalfx)), vzero), vcbcroffset);
+            const __m128i vcbf = _mm_mulhi_epi16(_mm_slli_epi16(vcb, THEORAPLAY_X86_CSCALE_BITS), _mm_set1_epi16(kbfactor << THEORAPLAY_X86_FACTOR_BITS(THEORAPLAY_X86_CSCALE_BITS)));
+            const __m128i vcrf = _mm_mulhi_epi16(_mm_slli_epi16(vcr, THEORAPLAY_X86_CSCALE_BITS), _mm_set1_epi16(krfactor << THEORAPLAY_X86_FACTOR_BITS(THEORAPLAY_X86_CSCALE_BITS)));
+            /* the green sum never leaves 16 bits (|x| <= 128 * (104 + 50)), so this one is a plain multiply and shift. */
+            const __m128i vcgf = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(vcr, _mm_set1_epi16(green_krfactor)), _mm_mullo_epi16(vcb, _mm_set1_epi16(green_kbfactor))), FIXED_POINT_BITS);
+
+            /* convert 8 Y' values and hand them to the output macro with their (duplicated) color components. */
+            #define THEORAPLAY_SSE2_CVT_TO_RGB(dst, vy8, vcrdup, vcgdup, vcbdup) { \
+                const __m128i vy = _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16((vy8), _mm_set1_epi16(yoffset)), THEORAPLAY_X86_YSCALE_BITS), _mm_set1_epi16(yfactor << THEORAPLAY_X86_FACTOR_BITS(THEORAPLAY_X86_YSCALE_BITS))); \
+                THEORAPLAY_CVT_RGB_OUTPUT_SSE2(dst, _mm_add_epi16(vy, vcrdup), _mm_sub_epi16(vy, vcgdup), _mm_add_epi16(vy, vcbdup)); \
+            }
 
-                /* duplicate every other element (upper half), since pairs of Y values use the same Cr/Cg/Cb components. */
-                vcrdup1 = vzip1q_s16(vcr2, vcr2);
-                vcgdup1 = vzip1q_s16(vcg2, vcg2);
-                vcbdup1 = vzip1q_s16(vcb2, vcb2);
-                vcrdup2 = vzip2q_s16(vcr2, vcr2);
-                vcgdup2 = vzip2q_s16(vcg2, vcg2);
-                vcbdup2 = vzip2q_s16(vcb2, vcb2);
+            /* pairs of Y' values use the same color components, so duplicate each one. */
+            const __m128i vcrdup1 = _mm_unpacklo_epi16(vcrf, vcrf);
+            const __m128i vcgdup1 = _mm_unpacklo_epi16(vcgf, vcgf);
+            const __m128i vcbdup1 = _mm_unpacklo_epi16(vcbf, vcbf);
+            const __m128i vcrdup2 = _mm_unpackhi_epi16(vcrf, vcrf);
+            const __m128i vcgdup2 = _mm_unpackhi_epi16(vcgf, vcgf);
+            const __m128i vcbdup2 = _mm_unpackhi_epi16(vcbf, vcbf);
+            const __m128i vy1 = _mm_loadu_si128((const __m128i *) (py + posx));
+            const __m128i vy2 = _mm_loadu_si128((const __m128i *) (py + posx + ystride));
 
-                /* get second set of 16 Y values from the first row. */
-                THEORAPLAY_NEON_CVT_TO_RGB(dst, ((const uint8_t *) py) + posx + 16, vcrdup1, vcgdup1, vcbdup1, vcrdup2, vcgdup2, vcbdup2);
+            /* 16 Y' values from the first row. */
+            THEORAPLAY_SSE2_CVT_TO_RGB(dst, _mm_unpacklo_epi8(vy1, vzero), vcrdup1, vcgdup1, vcbdup1);
+            THEORAPLAY_SSE2_CVT_TO_RGB(dst, _mm_unpackhi_epi8(vy1, vzero), vcrdup2, vcgdup2, vcbdup2);
 
-                /* get second set of 16 Y values from the second row. */
-                THEORAPLAY_NEON_CVT_TO_RGB(dst2, ((const uint8_t *) py) + posx + ystride + 16, vcrdup1, vcgdup1, vcbdup1, vcrdup2, vcgdup2, vcbdup2);
+            /* 16 Y' values from the second row. */
+            THEORAPLAY_SSE2_CVT_TO_RGB(dst2, _mm_unpacklo_epi8(vy2, vzero), vcrdup1, vcgdup1, vcbdup1);
+            THEORAPLAY_SSE2_CVT_TO_RGB(dst2, _mm_unpackhi_epi8(vy2, vzero), vcrdup2, vcgdup2, vcbdup2);
 
-                #undef THEORAPLAY_NEON_PREP_COMPONENT
-                #undef THEORAPLAY_NEON_FACTOR_AND_DOWNSHIFT
-                #undef THEORAPLAY_NEON_CVT_TO_RGB
+            #undef THEORAPLAY_SSE2_CVT_TO_RGB
 
-                poshalfx += 16;
-                posx += 32;
+            poshalfx += 8;
+            posx += 16;
+        }
+        #endif
+
+        #if THEORAPLAY_CVT_RGB_USE_AVX2
+        while ((halfw - poshalfx) >= 16)
+        {
+            const __m256i vcbcroffset = _mm256_set1_epi16(cbcroffset);
+            const __m256i vcb = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (pcb + poshalfx))), vcbcroffset);
+            const __m256i vcr = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (pcr + poshalfx))), vcbcroffset);
+            const __m256i vcbf = _mm256_mulhi_epi16(_mm256_slli_epi16(vcb, THEORAPLAY_X86_CSCALE_BITS), _mm256_set1_epi16(kbfactor << THEORAPLAY_X86_FACTOR_BITS(THEORAPLAY_X86_CSCALE_BITS)));
+            const __m256i vcrf = _mm256_mulhi_epi16(_mm256_slli_epi16(vcr, THEORAPLAY_X86_CSCALE_BITS), _mm256_set1_epi16(krfactor << THEORAPLAY_X86_FACTOR_BITS(THEORAPLAY_X86_CSCALE_BITS)));
+            const __m256i vcgf = _mm256_srai_epi16(_mm256_add_epi16(_mm256_mullo_epi16(vcr, _mm256_set1_epi16(green_krfactor)), _mm256_mullo_epi16(vcb, _mm256_set1_epi16(green_kbfactor))), FIXED_POINT_BITS);
+
+            /* unpack works inside each 128-bit lane, so duplicating gives us components 0-3,8-11 and 4-7,12-15;
+               swap the lanes around so each register covers 16 consecutive pixels. */
+            #define THEORAPLAY_AVX2_DUP_COMPONENT(v, dup1, dup2) { \
+                const __m256i lo = _mm256_unpacklo_epi16((v), (v)); \
+                const __m256i hi = _mm256_unpackhi_epi16((v), (v)); \
+                dup1 = _mm256_permute2x128_si256(lo, hi, 0x20); \
+                dup2 = _mm256_permute2x128_si256(lo, hi, 0x31); \
             }
-            #endif
 
-            while (poshalfx < halfw)  // finish out with scalar operations.
-            {
-                const int pb = pcb[poshalfx] - cbcroffset;
-                const int pr = pcr[poshalfx] - cbcroffset;
-                const int pb_factored = ((pb * kbfactor) >> FIXED_POINT_BITS);
-                const int pr_factored = ((pr * krfactor) >> FIXED_POINT_BITS);
-                const int pg_factored = (((green_krfactor * pr) + (green_kbfactor * pb)) >> FIXED_POINT_BITS);
-                {
-                    const int y1 = ((py[posx] - yoffset) * yfactor) >> FIXED_POINT_BITS;
-                    const int r1 = y1 + pr_factored;
-                    const int g1 = y1 - pg_factored;
-                    const int b1 = y1 + pb_factored;
-                    THEORAPLAY_CVT_RGB_OUTPUT(dst, r1, g1, b1);
-                }
-                {
-                    const int y2 = ((py[posx+1] - yoffset) * yfactor) >> FIXED_POINT_BITS;
-                    const int r2 = y2 + pr_factored;
-                    const int g2 = y2 - pg_factored;
-                    const int b2 = y2 + pb_factored;
-                    THEORAPLAY_CVT_RGB_OUTPUT(dst, r2, g2, b2);
-                }
-                {
-                    const int y3 = ((py[ystride+posx] - yoffset) * yfactor) >> FIXED_POINT_BITS;
-                    const int r3 = y3 + pr_factored;
-                    const int g3 = y3 - pg_factored;
-                    const int b3 = y3 + pb_factored;
-                    THEORAPLAY_CVT_RGB_OUTPUT(dst2, r3, g3, b3);
-                }
-                {
-                    const int y4 = ((py[ystride+posx+1] - yoffset) * yfactor) >> FIXED_POINT_BITS;
-                    const int r4 = y4 + pr_factored;
-                    const int g4 = y4 - pg_factored;
-                    const int b4 = y4 + pb_factored;
-                    THEORAPLAY_CVT_RGB_OUTPUT(dst2, r4, g4, b4);
-                }
+            #define THEORAPLAY_AVX2_CVT_TO_RGB(dst, src, vcrdup, vcgdup, vcbdup) { \
+                const __m256i vy = _mm256_mulhi_epi16(_mm256_slli_epi16(_mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (src))), _mm256_set1_epi16(yoffset)), THEORAPLAY_X86_YSCALE_BITS), _mm256_set1_epi16(yfactor << THEORAPLAY_X86_FACTOR_BITS(THEORAPLAY_X86_YSCALE_BITS))); \
+                THEORAPLAY_CVT_RGB_OUTPUT_AVX2(dst, _mm256_add_epi16(vy, vcrdup), _mm256_sub_epi16(vy, vcgdup), _mm256_add_epi16(vy, vcbdup)); \
+            }
+
+            __m256i vcrdup1, vcgdup1, vcbdup1, vcrdup2, vcgdup2, vcbdup2;
+            THEORAPLAY_AVX2_DUP_COMPONENT(vcrf, vcrdup1, vcrdup2);
+            THEORAPLAY_AVX2_DUP_COMPONENT(vcgf, vcgdup1, vcgdup2);
+            THEORAPLAY_AVX2_DUP_COMPONENT(vcbf, vcbdup1, vcbdup2);
+
+            /* 32 Y' values from the first row. */
+            THEORAPLAY_AVX2_CVT_TO_RGB(dst, py + posx, vcrdup1, vcgdup1, vcbdup1);
+            THEORAPLAY_AVX2_CVT_TO_RGB(dst, py + posx + 16, vcrdup2, vcgdup2, vcbdup2);
+
+            /* 32 Y' values from the second row. */
+            THEORAPLAY_AVX2_CVT_TO_RGB(dst2, py + posx + ystride, vcrdup1, vcgdup1, vcbdup1);
+            THEORAPLAY_AVX2_CVT_TO_RGB(dst2, py + posx + ystride + 16, vcrdup2, vcgdup2, vcbdup2);
+
+            #undef THEORAPLAY_AVX2_DUP_COMPONENT
+            #undef THEORAPLAY_AVX2_CVT_TO_RGB
+
+            poshalfx += 16;
+            posx += 32;
+        }
+        #endif
 
-                poshalfx++;
-                posx += 2;
-            } // while
+        #if THEORAPLAY_CVT_RGB_USE_SSE2 || THEORAPLAY_CVT_RGB_USE_AVX2
+        #undef THEORAPLAY_X86_YSCALE_BITS
+        #undef THEORAPLAY_X86_CSCALE_BITS
+        #undef THEORAPLAY_X86_FACTOR_BITS
+        #endif
 
-            dst += THEORAPLAY_CVT_RGB_DST_BUFFER_SIZE(w, 1);
-            dst2 += THEORAPLAY_CVT_RGB_DST_BUFFER_SIZE(w, 1);
+        while (poshalfx < halfw)  // finish out with scalar operations.
+        {
+            const int pb = pcb[poshalfx] - cbcroffset;
+            const int pr = pcr[poshalfx] - cbcroffset;
+            const int pb_factored = ((pb * kbfactor) >> FIXED_POINT_BITS);
+            const int pr_factored = ((pr * krfactor) >> FIXED_POINT_BITS);
+            const int pg_factored = (((green_krfactor * pr) + (green_kbfactor * pb)) >> FIXED_POINT_BITS);
+            {
+                const int y1 = ((py[posx] - yoffset) * yfactor) >> FIXED_POINT_BITS;
+                const int r1 = y1 + pr_factored;
+                const int g1 = y1 - pg_factored;
+                const int b1 = y1 + pb_factored;
+                THEORAPLAY_CVT_RGB_OUTPUT(dst, r1, g1, b1);
+            }
+            {
+                const int y2 = ((py[posx+1] - yoffset) * yfactor) >> FIXED_POINT_BITS;
+                const int r2 = y2 + pr_factored;
+                const int g2 = y2 - pg_factored;
+                const int b2 = y2 + pb_factored;
+                THEORAPLAY_CVT_RGB_OUTPUT(dst, r2, g2, b2);
+            }
+            {
+                const int y3 = ((py[ystride+posx] - yoffset) * yfactor) >> FIXED_POINT_BITS;
+                const int r3 = y3 + pr_factored;
+                const int g3 = y3 - pg_factored;
+                const int b3 = y3 + pb_factored;
+                THEORAPLAY_CVT_RGB_OUTPUT(dst2, r3, g3, b3);
+            }
+            {
+                const int y4 = ((py[ystride+posx+1] - yoffset) * yfactor) >> FIXED_POINT_BITS;
+                const int r4 = y4 + pr_factored;
+                const int g4 = y4 - pg_factored;
+                const int b4 = y4 + pb_factored;
+                THEORAPLAY_CVT_RGB_OUTPUT(dst2, r4, g4, b4);
+            }
+
+            poshalfx++;
+            posx += 2;
+        } // while
 
-            // adjust to the start of the next line.
-            py += ystride * 2;
-            pcb += cbstride;
-            pcr += crstride;
-        } // for
-    } // if
+        dst += THEORAPLAY_CVT_RGB_DST_BUFFER_SIZE(w, 1);
+        dst2 += THEORAPLAY_CVT_RGB_DST_BUFFER_SIZE(w, 1);
 
-    return pixels;
+        // adjust to the start of the next line.
+        py += ystride * 2;
+        pcb += cbstride;
+        pcr += crstride;
+    } // for
 } // THEORAPLAY_CVT_FNNAME_420
 
 #if PRECALC_YUVRGB_VALS
@@ -322,6 +424,7 @@ static unsigned char *THEORAPLAY_CVT_FNNAME_420(const THEORAPLAY_Allocator *allo
 #undef PRECALC_YUVRGB_VALS
 
 #undef THEORAPLAY_CVT_FNNAME_420
+#undef THEORAPLAY_CVT_RGB_FNATTR
 
 #ifndef THEORAPLAY_CVT_RGB_KEEP_SCALAR_DEFINES
 #undef THEORAPLAY_CVT_RGB_DST_BUFFER_SIZE
@@ -335,5 +438,15 @@ static unsigned char *THEORAPLAY_CVT_FNNAME_420(const THEORAPLAY_Allocator *allo
 #undef THEORAPLAY_CVT_RGB_OUTPUT_NEON
 #endif
 
+#ifdef THEORAPLAY_CVT_RGB_USE_SSE2
+#undef THEORAPLAY_CVT_RGB_USE_SSE2
+#undef THEORAPLAY_CVT_RGB_OUTPUT_SSE2
+#endif
+
+#ifdef THEORAPLAY_CVT_RGB_USE_AVX2
+#undef THEORAPLAY_CVT_RGB_USE_AVX2
+#undef THEORAPLAY_CVT_RGB_OUTPUT_AVX2
+#endif
+
 // end of theoraplay_cvtrgb.h ...
 